@@ -0,0 +1,286 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: macOS backend using libproc                                                                              */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#if defined(__APPLE__)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <pthread.h>
+
+#include <libproc.h>
+
+#include "sockstat.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define FDS_MIN         256                                                 /* First FDs array, entries */
+#define PIDS_SLACK      64                                                  /* Processes born while we list them */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct fdbuf {                                                              /* Per thread FDs array, only grows */
+    struct proc_fdinfo *fds;
+    int mfds;
+};
+
+static pthread_key_t fds_key;
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void fdbuf_free(void *p) {
+    struct fdbuf *b = (struct fdbuf *)p;
+
+    if (b) free(b->fds);
+    free(b);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_init(const struct filter *f) {
+    (void)f;
+
+    return pthread_key_create(&fds_key, fdbuf_free) ? -1 : 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct fdbuf *libproc_fds(void) {
+    struct fdbuf *b = (struct fdbuf *)pthread_getspecific(fds_key);
+
+    if (!b && (b = (struct fdbuf *)calloc(1, sizeof(struct fdbuf)))) pthread_setspecific(fds_key, b);
+    return b;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int fdbuf_grow(struct fdbuf *b, int need) {
+    struct proc_fdinfo *n;
+    int m = b->mfds ? b->mfds : FDS_MIN;
+
+    while (m < need) m *= 2;
+    if (m == b->mfds) return 0;
+    if (!(n = (struct proc_fdinfo *)realloc(b->fds, sizeof(struct proc_fdinfo) * m))) return -1;
+    STATS_ADD(st_bytes, sizeof(struct proc_fdinfo) * (m - b->mfds));
+    b->fds = n;
+    b->mfds = m;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_listfds(pid_t pid, struct fdbuf *b) {
+    /* PID => FDs. The array is sized by the biggest table seen so far, so it is reused for most processes. A full
+    array may mean the table did not fit: then ask the kernel how big it is, grow and retry */
+    int n;
+
+    if (fdbuf_grow(b, FDS_MIN) == -1) return -1;
+    for (;;) {
+        STATS_ADD(st_syscalls, 1);
+        if ((n = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, b->fds, sizeof(struct proc_fdinfo) * b->mfds)) <= 0) return 0;
+        if (n < (int)sizeof(struct proc_fdinfo) * b->mfds) return n / (int)sizeof(struct proc_fdinfo);
+
+        STATS_ADD(st_syscalls, 1);
+        n = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, NULL, 0) / (int)sizeof(struct proc_fdinfo);
+        if (fdbuf_grow(b, n > b->mfds ? n + n / 8 : b->mfds * 2) == -1) return -1;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_pids(pid_t **pids, int *npids) {
+    /* NB! proc_listpids() returns bytes (!), not count of pids (!). With no buffer it tells how many are needed */
+    int m, n;
+    pid_t *p;
+
+    *pids = NULL;
+    STATS_ADD(st_syscalls, 1);
+    if ((n = proc_listpids(PROC_ALL_PIDS, 0, NULL, 0)) <= 0) return -1;
+    for (m = n / (int)sizeof(pid_t) + PIDS_SLACK;; m *= 2) {
+        if (!(p = (pid_t *)realloc(*pids, sizeof(pid_t) * m))) {
+            free(*pids);
+            return -1;
+        }
+        *pids = p;
+        STATS_ADD(st_bytes, sizeof(pid_t) * m);
+        STATS_ADD(st_syscalls, 1);
+        if ((n = proc_listpids(PROC_ALL_PIDS, 0, *pids, sizeof(pid_t) * m)) <= 0) return -1;
+        if (n < (int)sizeof(pid_t) * m) break;                              /* Not full: all of them are here */
+    }
+    *npids = n / (int)sizeof(pid_t);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_proc(pid_t pid, struct proc_rec *pr) {
+    struct proc_bsdinfo pinfo;
+
+    STATS_ADD(st_syscalls, 1);
+    if (proc_pidinfo(pid, PROC_PIDTBSDINFO, 0, &pinfo, sizeof(pinfo)) < (int)sizeof(pinfo)) return -1;
+
+    pr->pr_pid = pinfo.pbi_pid;
+    pr->pr_uid = pinfo.pbi_uid;
+    strlcpy(pr->pr_comm, pinfo.pbi_name[0] ? pinfo.pbi_name : pinfo.pbi_comm, sizeof(pr->pr_comm));
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int tcp_state(int tsi_state) {
+    /* TSI_S_CLOSED .. TSI_S_TIME_WAIT are in the same order as TS_CLOSED .. TS_TIME_WAIT */
+    return tsi_state >= TSI_S_CLOSED && tsi_state <= TSI_S_TIME_WAIT ? tsi_state - TSI_S_CLOSED + TS_CLOSED :
+        TS_UNKNOWN;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_decode(const struct socket_fdinfo *si, int cols, struct sock_rec *sr) {
+    const struct in_sockinfo *ini;
+
+    switch (si->psi.soi_family) {
+        case AF_INET:
+        case AF_INET6:
+            if (si->psi.soi_kind == SOCKINFO_TCP) {
+                ini = &si->psi.soi_proto.pri_tcp.tcpsi_ini;
+                sr->sr_kind = si->psi.soi_family == AF_INET ? SK_TCP4 : SK_TCP6;
+                sr->sr_state = tcp_state(si->psi.soi_proto.pri_tcp.tcpsi_state);
+            } else {
+                ini = &si->psi.soi_proto.pri_in;
+                sr->sr_kind = si->psi.soi_family == AF_INET ? SK_UDP4 : SK_UDP6;
+            }
+            if (si->psi.soi_family == AF_INET) {
+                memcpy(&sr->sr_laddr, &ini->insi_laddr.ina_46.i46a_addr4, sizeof(struct in_addr));
+                memcpy(&sr->sr_faddr, &ini->insi_faddr.ina_46.i46a_addr4, sizeof(struct in_addr));
+            } else {
+                sr->sr_laddr = ini->insi_laddr.ina_6;
+                sr->sr_faddr = ini->insi_faddr.ina_6;
+            }
+            sr->sr_lport = ntohs(ini->insi_lport);
+            sr->sr_fport = ntohs(ini->insi_fport);
+            /* -O: the queues come with the socket info anyway; RTT and alike are not exported to user space */
+            if (cols & CX_QUEUES) {
+                sr->sr_sendq = si->psi.soi_snd.sbi_cc;
+                sr->sr_recvq = si->psi.soi_rcv.sbi_cc;
+                sr->sr_ext = CX_QUEUES;
+            }
+        break;
+
+        case AF_UNIX: /* aka LOCAL socket */
+            sr->sr_kind = SK_UNIX;
+            sr->sr_pcb = si->psi.soi_proto.pri_un.unsi_conn_pcb;
+            strlcpy(sr->sr_path, si->psi.soi_proto.pri_un.unsi_addr.ua_sun.sun_path, sizeof(sr->sr_path));
+            strlcpy(sr->sr_cpath, si->psi.soi_proto.pri_un.unsi_caddr.ua_sun.sun_path, sizeof(sr->sr_cpath));
+            sr->sr_peer = si->psi.soi_proto.pri_un.unsi_conn_pcb;           /* Peer soi_pcb */
+        break;
+
+        case AF_ROUTE: /* Not much info, do we need more? */
+            sr->sr_kind = SK_ROUTE;
+        break;
+
+        case AF_NDRV:
+            if (si->psi.soi_kind != SOCKINFO_NDRV) return -1;               /* is this check useless? */
+            sr->sr_kind = SK_NDRV;
+            sr->sr_u[0] = si->psi.soi_proto.pri_ndrv.ndrvsi_if_unit;
+            strlcpy(sr->sr_path, (const char *)si->psi.soi_proto.pri_ndrv.ndrvsi_if_name, sizeof(sr->sr_path));
+        break;
+
+        case AF_SYSTEM:
+            switch (si->psi.soi_kind) {
+                case SOCKINFO_KERN_EVENT:
+                    sr->sr_kind = SK_KEVT;
+                    sr->sr_u[0] = si->psi.soi_proto.pri_kern_event.kesi_vendor_code_filter;
+                    sr->sr_u[1] = si->psi.soi_proto.pri_kern_event.kesi_class_filter;
+                    sr->sr_u[2] = si->psi.soi_proto.pri_kern_event.kesi_subclass_filter;
+                break;
+
+                case SOCKINFO_KERN_CTL:
+                    sr->sr_kind = SK_KCTL;
+                    sr->sr_u[0] = si->psi.soi_proto.pri_kern_ctl.kcsi_id;
+                    sr->sr_u[1] = si->psi.soi_proto.pri_kern_ctl.kcsi_unit;
+                    strlcpy(sr->sr_path, si->psi.soi_proto.pri_kern_ctl.kcsi_name, sizeof(sr->sr_path));
+                break;
+
+                default: /* May this ever happen? */
+                    sr->sr_kind = SK_SUNKN;
+                break;
+            }
+        break;
+
+        default:
+            sr->sr_kind = SK_UNK;
+        break;
+    }
+
+    if (sr->sr_kind != SK_UNIX) sr->sr_pcb = si->psi.soi_pcb;
+    sr->sr_ino = si->psi.soi_pcb;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int libproc_socks(const struct proc_rec *pr, const struct filter *f, emit_fn emit, void *arg) {
+    struct fdbuf *b = libproc_fds();
+    struct proc_fdinfo *fds;
+    struct socket_fdinfo si;
+    struct sock_rec sr;
+    int nfds = 0, nsocks = 0, r;
+
+    if (!b || (nfds = libproc_listfds(pr->pr_pid, b)) == -1) return -1;
+    fds = b->fds;
+    STATS_ADD(st_fds, nfds);
+    for (int k = 0; k < nfds; k++) {
+        if (fds[k].proc_fdtype != PROX_FDTYPE_SOCKET) continue;             /* Save a syscall on files and pipes */
+
+        STATS_ENTER(ST_SOCKS);
+        STATS_ADD(st_syscalls, 1);
+        memset(&sr, 0, sizeof(sr));
+        sr.sr_fd = fds[k].proc_fd;
+        r = proc_pidfdinfo(pr->pr_pid, fds[k].proc_fd, PROC_PIDFDSOCKETINFO, &si, sizeof(si)) == (int)sizeof(si) &&
+            libproc_decode(&si, f->f_cols, &sr) == 0;
+        STATS_LEAVE();
+        if (!r) continue;
+        emit(pr, &sr, arg);
+        nsocks++;
+    }
+
+    return nsocks;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void libproc_fini(void) {
+    fdbuf_free(pthread_getspecific(fds_key));                               /* Workers free theirs on exit */
+    pthread_setspecific(fds_key, NULL);
+    pthread_key_delete(fds_key);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const struct backend libproc_backend = {
+    "libproc",
+    libproc_init,
+    libproc_pids,
+    libproc_proc,
+    libproc_socks,
+    libproc_fini,
+    NULL,                                                                   /* FD numbers and types tell nothing */
+    NULL,
+    NULL
+};
+
+#endif /* __APPLE__ */
@@ -0,0 +1,888 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: Linux backends using /proc and netlink sock_diag                                                       */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <pthread.h>
+
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
+#include <linux/tcp.h>
+
+#include "sockstat.h"
+#include "hash.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define PROC_NET        "/proc/net/"
+#define NET_BUFSZ       (1024 * 1024)                                       /* stdio buffer for /proc/net files */
+#define NL_BUFSZ        (1024 * 1024)                                       /* Netlink receive buffer */
+#define NL_SOCK_BUFSZ   (8 * 1024 * 1024)                                   /* Netlink socket SO_RCVBUF */
+#define DENTS_BUFSZ     (256 * 1024)                                        /* getdents64() chunk, ~10k FDs */
+#define NL_BC_SIZE      4096                                                /* -P bytecode, up to 102 ranges */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct pent {                                                               /* A socket from /proc/net, no owner */
+    uint64_t ino;
+    struct in6_addr laddr;
+    struct in6_addr faddr;
+    uint16_t lport;
+    uint16_t fport;
+    uint16_t kind;
+    uint8_t state;
+    uint32_t path;                                                          /* Offset in paths pool, 0 - none */
+    uint64_t peer;                                                          /* UNIX peer inode, sock_diag only */
+};
+
+struct pext {                                                               /* -O values of a pent */
+    uint32_t sendq;
+    uint32_t recvq;
+    uint32_t rtt;
+    uint32_t retrans;
+    uint32_t cwnd;
+    int known;                                                              /* CX_* */
+};
+
+struct ofd {                                                                /* A socket FD found by owned_collect() */
+    uint64_t ino;
+    int fd;
+};
+
+struct ldirent {                                                            /* A getdents64() record */
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct pent *ptab = NULL;                                            /* All sockets of the system */
+static size_t npent = 0, mpent = 0;
+static char *paths = NULL;                                                  /* UNIX socket paths pool */
+static size_t lpaths = 0, mpaths = 0;
+static struct hash inodes;                                                  /* inode => ptab index */
+static struct hash owned;                                                   /* -p/-e/-c: sockets of the chosen */
+static struct hash owned_pids;                                              /* PID => ofds start << 32 | count */
+static struct ofd *ofds = NULL;
+static size_t nofd = 0, mofd = 0;
+static int owned_on = 0;                                                    /* Only owned sockets go to ptab */
+static struct pext *pxtab = NULL;                                           /* Parallel to ptab, only with -O */
+static int px_cols = 0;                                                     /* CX_* asked for */
+static pthread_key_t dents_key;                                             /* Per thread getdents64() buffer */
+static pthread_once_t dents_once = PTHREAD_ONCE_INIT;
+
+/* Linux TCP_ESTABLISHED .. TCP_NEW_SYN_RECV => TS_* */
+static const uint8_t tcp_states[] = {
+    TS_UNKNOWN, TS_ESTABLISHED, TS_SYN_SENT, TS_SYN_RECEIVED, TS_FIN_WAIT_1, TS_FIN_WAIT_2, TS_TIME_WAIT,
+    TS_CLOSED, TS_CLOSE_WAIT, TS_LAST_ACK, TS_LISTEN, TS_CLOSING, TS_SYN_RECEIVED
+};
+#define LINUX_TCP_LISTEN        10
+#define LINUX_TCP_TIME_WAIT     6
+#define LINUX_TCP_NEW_SYN_RECV  12
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int nl_collect(const struct filter *f);
+static int owned_collect(const struct filter *f);
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *field(char **s) {
+    /* Cut the next blank separated field from the line */
+    char *f;
+
+    while (**s == ' ' || **s == '\t') (*s)++;
+    f = *s;
+    while (**s && **s != ' ' && **s != '\t' && **s != '\n') (*s)++;
+    if (**s) *(*s)++ = '\0';
+    return f;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const char *hex32(const char *s, uint32_t *v) {
+    /* Parse up to 8 hex digits, stop at anything else */
+    uint32_t r = 0;
+    int n = 0;
+
+    for (; n < 8; s++, n++) {
+        if (*s >= '0' && *s <= '9') r = (r << 4) | (uint32_t)(*s - '0');
+        else if (*s >= 'A' && *s <= 'F') r = (r << 4) | (uint32_t)(*s - 'A' + 10);
+        else if (*s >= 'a' && *s <= 'f') r = (r << 4) | (uint32_t)(*s - 'a' + 10);
+        else break;
+    }
+    *v = r;
+    return s;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int inet_endpoint(const char *s, int words, struct in6_addr *addr, uint16_t *port) {
+    /* "0100007F:BC8F" - the kernel prints each 32-bit word of the address in the host byte order */
+    uint32_t w, p;
+
+    for (int i = 0; i < words; i++) {
+        s = hex32(s, &w);
+        memcpy((char *)addr + i * sizeof(w), &w, sizeof(w));
+    }
+    if (*s++ != ':') return -1;
+    hex32(s, &p);
+    *port = (uint16_t)p;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct pent *pent_new(uint64_t ino) {
+    struct pent *pe;
+    uint64_t *idx;
+    int isnew = 0;
+
+    if (!ino) return NULL;                                                  /* TIME_WAIT and orphans have no owner */
+    if (owned_on && !hash_get(&owned, ino)) return NULL;                    /* Nobody we show holds it */
+    if (npent == mpent) {
+        size_t m = mpent ? mpent * 2 : 1024;
+        struct pext *px;
+
+        if (px_cols) {
+            if (!(px = (struct pext *)realloc(pxtab, sizeof(struct pext) * m))) return NULL;
+            STATS_ADD(st_bytes, sizeof(struct pext) * (m - mpent));
+            pxtab = px;
+        }
+        if (!(pe = (struct pent *)realloc(ptab, sizeof(struct pent) * m))) return NULL;
+        STATS_ADD(st_bytes, sizeof(struct pent) * (m - mpent));
+        ptab = pe;
+        mpent = m;
+    }
+    if (!(idx = hash_put(&inodes, ino, &isnew)) || !isnew) return NULL;     /* Same socket listed twice */
+    *idx = npent;
+    if (pxtab) memset(&pxtab[npent], 0, sizeof(struct pext));
+    pe = &ptab[npent++];
+    memset(pe, 0, sizeof(*pe));
+    pe->ino = ino;
+    return pe;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct pext *pext_of(const struct pent *pe) {
+    return pxtab ? &pxtab[pe - ptab] : NULL;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static uint32_t path_add(const char *p) {
+    size_t l = strlen(p) + 1;
+    uint32_t off;
+    char *n;
+
+    if (!lpaths) lpaths = 1;                                                /* Offset 0 means "no path" */
+    if (lpaths + l > mpaths) {
+        size_t m = mpaths ? mpaths * 2 : 64 * 1024;
+
+        while (lpaths + l > m) m *= 2;
+        if (!(n = (char *)realloc(paths, m))) return 0;
+        STATS_ADD(st_bytes, m - mpaths);
+        paths = n;
+        mpaths = m;
+    }
+    off = (uint32_t)lpaths;
+    memcpy(paths + lpaths, p, l);
+    lpaths += l;
+    return off;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static FILE *net_open(const char *name, char *buf) {
+    char fname[64];
+    FILE *f;
+
+    snprintf(fname, sizeof(fname), PROC_NET "%s", name);
+    STATS_ADD(st_syscalls, 1);
+    if (!(f = fopen(fname, "r"))) return NULL;                              /* No IPv6 in the kernel or alike */
+    setvbuf(f, buf, _IOFBF, NET_BUFSZ);
+    return f;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void net_close(FILE *f) {
+    /* seq_file fills the whole buffer on each read(): one per NET_BUFSZ, one more for EOF, and close() */
+    STATS_ADD(st_syscalls, ftell(f) / NET_BUFSZ + 2);
+    fclose(f);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void net_inet(const char *name, int kind, const struct filter *flt, char *buf) {
+    /* sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode ... */
+    int words = kind & (SK_TCP6 | SK_UDP6) ? 4 : 1;
+    char line[512], *s, *laddr, *faddr, *st, *txrx;
+    struct in6_addr la, fa;
+    uint16_t lp, fp;
+    uint32_t state;
+    struct pent *pe;
+    struct pext *px;
+    FILE *f;
+
+    if (!(f = net_open(name, buf))) return;
+    if (!fgets(line, sizeof(line), f)) goto done;                           /* Header */
+
+    while (fgets(line, sizeof(line), f)) {
+        s = line;
+        field(&s);                                                          /* sl */
+        laddr = field(&s);
+        faddr = field(&s);
+        st = field(&s);
+        hex32(st, &state);
+        /* LISTENing TCP sockets only: do not even bother to join the others */
+        if (flt->f_listen && kind & SK_TCP && state != LINUX_TCP_LISTEN) continue;
+
+        txrx = field(&s);
+        for (int i = 0; i < 4; i++) field(&s);                              /* tr:tm retrnsmt uid timeout */
+        memset(&la, 0, sizeof(la));
+        memset(&fa, 0, sizeof(fa));
+        if (inet_endpoint(laddr, words, &la, &lp) == -1 || inet_endpoint(faddr, words, &fa, &fp) == -1) continue;
+        if (flt->f_nports && !ports_match(flt, lp, fp)) continue;           /* Port pushdown */
+        if (!(pe = pent_new(strtoull(field(&s), NULL, 10)))) continue;
+
+        pe->kind = kind;
+        pe->laddr = la; pe->lport = lp;
+        pe->faddr = fa; pe->fport = fp;
+        if (kind & SK_TCP) pe->state = state < sizeof(tcp_states) ? tcp_states[state] : TS_UNKNOWN;
+        if ((px = pext_of(pe)) && px_cols & CX_QUEUES) {
+            hex32(hex32(txrx, &px->sendq) + 1, &px->recvq);                 /* "%08X:%08X" */
+            px->known = pe->state == TS_LISTEN ? CX_RECVQ : CX_QUEUES;
+        }
+    }
+
+done:
+    net_close(f);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void net_unix(char *buf) {
+    /* Num: RefCount Protocol Flags Type St Inode Path */
+    char line[512], *s, *p;
+    struct pent *pe;
+    FILE *f;
+
+    if (!(f = net_open("unix", buf))) return;
+    if (!fgets(line, sizeof(line), f)) goto done;
+
+    while (fgets(line, sizeof(line), f)) {
+        s = line;
+        for (int i = 0; i < 6; i++) field(&s);
+        if (!(pe = pent_new(strtoull(field(&s), NULL, 10)))) continue;
+
+        pe->kind = SK_UNIX;
+        while (*s == ' ') s++;
+        if (*s && *s != '\n') {
+            if ((p = strchr(s, '\n'))) *p = '\0';
+            pe->path = path_add(s);
+        }
+    }
+
+done:
+    net_close(f);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_init(const struct filter *f) {
+    struct filter nf = *f;
+    int want = f->f_want;
+    char *buf;
+
+    px_cols = f->f_cols;
+    if (!inodes.size && hash_init(&inodes, 4096) == -1) return -1;
+    if (owned_collect(f) == -1) return -1;
+    if (owned_on && !owned.count) return 0;                                 /* No process passes -p, -e, -c */
+    if (f->f_nports) want &= SK_INET;                                       /* Only inet sockets have ports */
+    if (!(buf = (char *)malloc(NET_BUFSZ))) return -1;
+    STATS_ADD(st_bytes, NET_BUFSZ);
+
+    /* /proc/net has neither UNIX peers for -x nor tcp_info for -O: take such tables from sock_diag if we may */
+    nf.f_want = f->f_want & ((f->f_peers ? SK_UNIX : 0) | (f->f_cols & CX_INFO ? SK_TCP : 0));
+    if (nf.f_want && nl_collect(&nf) == 0) want &= ~nf.f_want;
+
+    /* Parse the global socket tables once, only those anybody asked for */
+    if (want & SK_TCP4) net_inet("tcp", SK_TCP4, f, buf);
+    if (want & SK_TCP6) net_inet("tcp6", SK_TCP6, f, buf);
+    if (want & SK_UDP4) net_inet("udp", SK_UDP4, f, buf);
+    if (want & SK_UDP6) net_inet("udp6", SK_UDP6, f, buf);
+    if (want & SK_UNIX) net_unix(buf);
+
+    free(buf);
+    return 0;
+}
+
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* netlink sock_diag: the kernel dumps whole socket tables in bulk and filters them by state, family and port         */
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int nl_dump(int nl, void *req, size_t len, char *buf, void (*parse)(const struct nlmsghdr *h)) {
+    struct sockaddr_nl sa = {0};
+    struct nlmsghdr *h = (struct nlmsghdr *)req;
+    ssize_t n;
+
+    sa.nl_family = AF_NETLINK;
+    h->nlmsg_len = len;
+    h->nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    h->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    STATS_ADD(st_syscalls, 1);
+    if (sendto(nl, req, len, 0, (struct sockaddr *)&sa, sizeof(sa)) == -1) return -1;
+
+    for (;;) {
+        STATS_ADD(st_syscalls, 1);
+        if ((n = recv(nl, buf, NL_BUFSZ, 0)) == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (!n) {                                                           /* Not a dump socket, no NLMSG_DONE */
+            errno = EIO;
+            return -1;
+        }
+        for (h = (struct nlmsghdr *)buf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            if (h->nlmsg_type == NLMSG_DONE) return 0;
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                errno = -((struct nlmsgerr *)NLMSG_DATA(h))->error;
+                return -1;
+            }
+            parse(h);
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int nl_kind;                                                         /* SK_* of the current inet dump */
+static const struct filter *nl_filter;
+
+static void nl_inet(const struct nlmsghdr *h) {
+    const struct inet_diag_msg *m = (const struct inet_diag_msg *)NLMSG_DATA(h);
+    const struct rtattr *a;
+    struct tcp_info ti;
+    struct pent *pe;
+    struct pext *px;
+    int l;
+
+    if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*m))) return;
+    if (nl_filter->f_nports && !ports_match(nl_filter, ntohs(m->id.idiag_sport), ntohs(m->id.idiag_dport))) return;
+    if (!(pe = pent_new(m->idiag_inode))) return;
+
+    pe->kind = nl_kind;
+    /* id.idiag_src/dst are in the network byte order, the same bytes as in struct in(6)_addr */
+    memcpy(&pe->laddr, m->id.idiag_src, nl_kind & SK_TCP6 || nl_kind & SK_UDP6 ? 16 : 4);
+    memcpy(&pe->faddr, m->id.idiag_dst, nl_kind & SK_TCP6 || nl_kind & SK_UDP6 ? 16 : 4);
+    pe->lport = ntohs(m->id.idiag_sport);
+    pe->fport = ntohs(m->id.idiag_dport);
+    if (nl_kind & SK_TCP) pe->state = m->idiag_state < sizeof(tcp_states) ? tcp_states[m->idiag_state] : TS_UNKNOWN;
+    if (!(px = pext_of(pe))) return;
+
+    /* A listener has the accept queue in rqueue and its limit in wqueue. /proc/net has no limit: SEND-Q is "-" */
+    px->sendq = m->idiag_wqueue;
+    px->recvq = m->idiag_rqueue;
+    px->known = pe->state == TS_LISTEN ? CX_RECVQ : CX_QUEUES;
+    l = h->nlmsg_len - NLMSG_LENGTH(sizeof(*m));
+    for (a = (const struct rtattr *)(m + 1); RTA_OK(a, l); a = RTA_NEXT(a, l)) {
+        if (a->rta_type != INET_DIAG_INFO) continue;
+        /* Older kernels send a shorter tcp_info, newer ones a longer */
+        memset(&ti, 0, sizeof(ti));
+        memcpy(&ti, RTA_DATA(a), RTA_PAYLOAD(a) < (int)sizeof(ti) ? RTA_PAYLOAD(a) : (int)sizeof(ti));
+        px->rtt = ti.tcpi_rtt;
+        px->retrans = ti.tcpi_total_retrans;
+        px->cwnd = ti.tcpi_snd_cwnd;
+        px->known |= CX_INFO;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void nl_unix(const struct nlmsghdr *h) {
+    const struct unix_diag_msg *m = (const struct unix_diag_msg *)NLMSG_DATA(h);
+    const struct rtattr *a;
+    char name[SR_PATHLEN];
+    struct pent *pe;
+    int l, al;
+
+    if (h->nlmsg_len < NLMSG_LENGTH(sizeof(*m))) return;
+    if (!(pe = pent_new(m->udiag_ino))) return;
+    pe->kind = SK_UNIX;
+
+    l = h->nlmsg_len - NLMSG_LENGTH(sizeof(*m));
+    for (a = (const struct rtattr *)(m + 1); RTA_OK(a, l); a = RTA_NEXT(a, l)) {
+        switch (a->rta_type) {
+            case UNIX_DIAG_NAME:
+                if ((al = RTA_PAYLOAD(a)) <= 0) break;
+                if (al > SR_PATHLEN - 1) al = SR_PATHLEN - 1;
+                memcpy(name, RTA_DATA(a), al);
+                name[al] = '\0';
+                if (!name[0]) name[0] = '@';                                /* Abstract, like /proc/net/unix does */
+                pe->path = path_add(name);
+            break;
+
+            case UNIX_DIAG_PEER:
+                pe->peer = *(const uint32_t *)RTA_DATA(a);
+            break;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int nl_ports(const struct filter *f, unsigned char *bc, int size) {
+    /* -P as inet_diag bytecode: the local or the remote port is in one of the ranges. Every range test is followed by
+    a jump to the end, which accepts; a failed test skips that jump to the next test, the last one past the end,
+    which rejects. Returns the length, 0 if the ranges do not fit */
+    struct inet_diag_bc_op *op = (struct inet_diag_bc_op *)bc;
+    int nt = f->f_nports * 2, len = nt * 16 + (nt - 1) * 4, local;
+
+    if (!nt || len > size) return 0;
+    for (int t = 0; t < nt; t++) {
+        local = !(t & 1);
+        *op++ = (struct inet_diag_bc_op){ local ? INET_DIAG_BC_S_GE : INET_DIAG_BC_D_GE, 8, 20 };
+        *op++ = (struct inet_diag_bc_op){ 0, 0, f->f_ports[t / 2].lo };
+        *op++ = (struct inet_diag_bc_op){ local ? INET_DIAG_BC_S_LE : INET_DIAG_BC_D_LE, 8, 12 };
+        *op++ = (struct inet_diag_bc_op){ 0, 0, f->f_ports[t / 2].hi };
+        if (t < nt - 1) {
+            *op = (struct inet_diag_bc_op){ INET_DIAG_BC_JMP, 4, (unsigned short)(len - ((unsigned char *)op - bc)) };
+            op++;
+        }
+    }
+    return len;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int nl_collect(const struct filter *f) {
+    static const struct { int kind; int family; int proto; } inet[] = {
+        { SK_TCP4, AF_INET, IPPROTO_TCP }, { SK_TCP6, AF_INET6, IPPROTO_TCP },
+        { SK_UDP4, AF_INET, IPPROTO_UDP }, { SK_UDP6, AF_INET6, IPPROTO_UDP }
+    };
+    struct { struct nlmsghdr h; struct inet_diag_req_v2 r; struct rtattr a; unsigned char bc[NL_BC_SIZE]; } ireq;
+    struct { struct nlmsghdr h; struct unix_diag_req r; } ureq;
+    int rcvbuf = NL_SOCK_BUFSZ;
+    size_t ilen = (char *)&ireq.a - (char *)&ireq;
+    char *buf;
+    int nl, bclen;
+
+    STATS_ADD(st_syscalls, 3);                                              /* socket(), setsockopt(), close() */
+    if ((nl = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG)) == -1) return -1;
+    /* Big socket buffer to survive huge dumps; FORCE works for root only, so try the plain one as well */
+    if (setsockopt(nl, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+        setsockopt(nl, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (!(buf = (char *)malloc(NL_BUFSZ))) {
+        close(nl);
+        return -1;
+    }
+    STATS_ADD(st_bytes, NL_BUFSZ);
+
+    if ((bclen = nl_ports(f, ireq.bc, sizeof(ireq.bc)))) {                  /* Port pushdown for -P */
+        ireq.a.rta_type = INET_DIAG_REQ_BYTECODE;
+        ireq.a.rta_len = RTA_LENGTH(bclen);
+        ilen += RTA_LENGTH(bclen);
+    }
+
+    for (size_t i = 0; i < sizeof(inet) / sizeof(inet[0]); i++) {
+        if (!(f->f_want & inet[i].kind)) continue;                          /* Family/protocol pushdown */
+
+        memset(&ireq.h, 0, sizeof(ireq.h));
+        memset(&ireq.r, 0, sizeof(ireq.r));
+        ireq.r.sdiag_family = inet[i].family;
+        ireq.r.sdiag_protocol = inet[i].proto;
+        if (inet[i].kind & SK_TCP && f->f_listen)
+            ireq.r.idiag_states = 1 << LINUX_TCP_LISTEN;                    /* State pushdown for -l */
+        else
+            /* TIME_WAIT and not yet accepted sockets have no inode, hence no owner: skip them in the kernel */
+            ireq.r.idiag_states = ~(1U << LINUX_TCP_TIME_WAIT | 1U << LINUX_TCP_NEW_SYN_RECV);
+        if (inet[i].kind & SK_TCP && f->f_cols & CX_INFO)
+            ireq.r.idiag_ext = 1 << (INET_DIAG_INFO - 1);                   /* tcp_info only if -O shows it */
+        nl_kind = inet[i].kind;
+        nl_filter = f;
+        if (nl_dump(nl, &ireq, ilen, buf, nl_inet) == -1) goto fail;
+    }
+
+    if (f->f_want & SK_UNIX && !f->f_nports) {                              /* No ports: -P drops them all */
+        memset(&ureq, 0, sizeof(ureq));
+        ureq.r.sdiag_family = AF_UNIX;
+        ureq.r.udiag_states = ~0U;
+        /* No connected-to path as on macOS: /proc/net/unix can not tell it, and -N must show the same rows */
+        ureq.r.udiag_show = UDIAG_SHOW_NAME | (f->f_peers ? UDIAG_SHOW_PEER : 0);
+        if (nl_dump(nl, &ureq, sizeof(ureq), buf, nl_unix) == -1) goto fail;
+    }
+
+    free(buf);
+    close(nl);
+    return 0;
+
+fail:
+    free(buf);
+    close(nl);
+    return -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int netlink_init(const struct filter *f) {
+    px_cols = f->f_cols;
+    if (hash_init(&inodes, 4096) == -1) return -1;
+    if (owned_collect(f) == -1) return -1;
+    if (owned_on && !owned.count) return 0;                                 /* No process passes -p, -e, -c */
+    if (nl_collect(f) == 0) return 0;
+
+    /* No sock_diag modules or not allowed in a container: do it the /proc way. Duplicates are dropped by pent_new() */
+    perror("netlink sock_diag failed, falling back to /proc/net");
+    return procfs_init(f);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void dents_key_init(void) {
+    pthread_key_create(&dents_key, free);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *dents_buf(void) {
+    /* The calling thread's getdents64() buffer, allocated once and reused for every directory */
+    char *b;
+
+    pthread_once(&dents_once, dents_key_init);
+    if (!(b = (char *)pthread_getspecific(dents_key)) && (b = (char *)malloc(DENTS_BUFSZ))) {
+        STATS_ADD(st_bytes, DENTS_BUFSZ);
+        pthread_setspecific(dents_key, b);
+    }
+    return b;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static long dents_read(int fd, char *buf) {
+    /* Next chunk of a directory: bytes of ldirent records, 0 at the end */
+    long n;
+
+    do {
+        STATS_ADD(st_syscalls, 1);
+        n = syscall(SYS_getdents64, fd, buf, DENTS_BUFSZ);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_pids(pid_t **pids, int *npids) {
+    char *buf = dents_buf(), *e;
+    struct ldirent *de;
+    int m = 1024, n = 0, fd;
+    pid_t *p, pid;
+    long len;
+
+    if (!buf) return -1;
+    STATS_ADD(st_syscalls, 2);                                              /* open(), close() */
+    if ((fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return -1;
+    if (!(*pids = (pid_t *)malloc(sizeof(pid_t) * m))) {
+        close(fd);
+        return -1;
+    }
+    STATS_ADD(st_bytes, sizeof(pid_t) * m);
+
+    while ((len = dents_read(fd, buf)) > 0)
+        for (long off = 0; off < len; off += de->d_reclen) {
+            de = (struct ldirent *)(buf + off);
+            if (de->d_name[0] < '1' || de->d_name[0] > '9') continue;
+            pid = (pid_t)strtol(de->d_name, &e, 10);
+            if (*e) continue;
+            if (n == m) {
+                if (!(p = (pid_t *)realloc(*pids, sizeof(pid_t) * m * 2))) goto done;
+                STATS_ADD(st_bytes, sizeof(pid_t) * m);
+                *pids = p;
+                m *= 2;
+            }
+            (*pids)[n++] = pid;
+        }
+
+done:
+    close(fd);
+    *npids = n;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_proc(pid_t pid, struct proc_rec *pr) {
+    /* /proc/<pid>/status has both the command name and the effective UID */
+    char fname[64], buf[1024], *s, *e;
+    ssize_t n;
+    int fd, got = 0;
+
+    snprintf(fname, sizeof(fname), "/proc/%d/status", (int)pid);
+    STATS_ADD(st_syscalls, 3);
+    if ((fd = open(fname, O_RDONLY)) == -1) return -1;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    pr->pr_pid = pid;
+    for (s = buf; s && *s && got != 3; s = (e = strchr(s, '\n')) ? e + 1 : NULL) {
+        if (!strncmp(s, "Name:\t", 6)) {
+            s += 6;
+            for (n = 0; s[n] && s[n] != '\n' && n < PR_COMMLEN - 1; n++) pr->pr_comm[n] = s[n];
+            pr->pr_comm[n] = '\0';
+            got |= 1;
+        } else if (!strncmp(s, "Uid:\t", 5)) {
+            strtoul(s + 5, &e, 10);                                         /* Real, then effective */
+            pr->pr_uid = (uid_t)strtoul(e, NULL, 10);
+            got |= 2;
+        }
+    }
+
+    return got == 3 ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void pent_join(const struct pent *pe, struct sock_rec *sr) {
+    const struct pext *px;
+
+    sr->sr_kind = pe->kind;
+    sr->sr_state = pe->state;
+    sr->sr_laddr = pe->laddr; sr->sr_lport = pe->lport;
+    sr->sr_faddr = pe->faddr; sr->sr_fport = pe->fport;
+    sr->sr_ino = sr->sr_pcb = pe->ino;
+    if (pe->path) strncpy(sr->sr_path, paths + pe->path, sizeof(sr->sr_path) - 1);
+    sr->sr_peer = pe->peer;
+    if ((px = pext_of(pe))) {
+        sr->sr_ext = px->known;
+        sr->sr_sendq = px->sendq;
+        sr->sr_recvq = px->recvq;
+        sr->sr_rtt = px->rtt;
+        sr->sr_retrans = px->retrans;
+        sr->sr_cwnd = px->cwnd;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int sock_join(uint64_t ino, int fd, const struct filter *f, struct sock_rec *sr) {
+    /* Socket inode of an FD => sr from the tables. Returns 0 if nobody wants it */
+    uint64_t *idx;
+
+    memset(sr, 0, sizeof(*sr));
+    sr->sr_fd = fd;
+    if ((idx = hash_get(&inodes, ino))) {
+        pent_join(&ptab[*idx], sr);
+    } else {
+        /* Not in the tables we parsed: either filtered out, or a family we do not decode */
+        if (!(f->f_want & SK_UNK) || f->f_nports) return 0;
+        sr->sr_kind = SK_UNK;
+        sr->sr_ino = sr->sr_pcb = ino;
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int fd_sock(int dfd, const char *name, const struct filter *f, struct sock_rec *sr) {
+    /* /proc/<pid>/fd/<name> => socket. Returns 0 if it is not one or nobody wants it */
+    char lnk[64], *e;
+    uint64_t ino;
+    ssize_t l;
+
+    STATS_ADD(st_syscalls, 1);
+    if ((l = readlinkat(dfd, name, lnk, sizeof(lnk) - 1)) < 9) return 0;
+    lnk[l] = '\0';
+    if (strncmp(lnk, "socket:[", 8)) return 0;
+
+    ino = strtoull(lnk + 8, &e, 10);
+    if (*e != ']') return 0;
+    return sock_join(ino, (int)strtol(name, NULL, 10), f, sr);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_socks(const struct proc_rec *pr, const struct filter *f, emit_fn emit, void *arg) {
+    /* The FD directory is read in DENTS_BUFSZ chunks, so a process with a million descriptors costs no more memory
+    than the others */
+    char dname[64], *buf = dents_buf();
+    struct ldirent *de;
+    struct sock_rec sr;
+    const struct ofd *o, *oend;
+    uint64_t *v;
+    int nsocks = 0, fd, r;
+    long len;
+
+    if (!npent && (!(f->f_want & SK_UNK) || f->f_nports)) return 0;         /* No socket could pass the filters */
+    if (owned_on && (v = hash_get(&owned_pids, (uint32_t)pr->pr_pid))) {
+        /* owned_collect() has read the FDs already */
+        for (o = &ofds[*v >> 32], oend = o + (uint32_t)*v; o < oend; o++) {
+            if (!sock_join(o->ino, o->fd, f, &sr)) continue;
+            emit(pr, &sr, arg);
+            nsocks++;
+        }
+        return nsocks;
+    }
+    snprintf(dname, sizeof(dname), "/proc/%d/fd", (int)pr->pr_pid);
+    if (!buf) return -1;
+    STATS_ADD(st_syscalls, 2);                                              /* open(), close() */
+    if ((fd = open(dname, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) return 0;  /* Gone or not ours */
+
+    while ((len = dents_read(fd, buf)) > 0)
+        for (long off = 0; off < len; off += de->d_reclen) {
+            de = (struct ldirent *)(buf + off);
+            if (de->d_name[0] < '0' || de->d_name[0] > '9') continue;
+            STATS_ADD(st_fds, 1);
+            STATS_ENTER(ST_SOCKS);
+            r = fd_sock(fd, de->d_name, f, &sr);
+            STATS_LEAVE();
+            if (!r) continue;
+            emit(pr, &sr, arg);
+            nsocks++;
+        }
+
+    close(fd);
+    return nsocks;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void owned_put(const struct proc_rec *pr, const struct sock_rec *sr, void *arg) {
+    struct ofd *o;
+
+    (void)pr; (void)arg;
+    if (nofd == mofd) {
+        size_t m = mofd ? mofd * 2 : 1024;
+
+        if (!(o = (struct ofd *)realloc(ofds, sizeof(struct ofd) * m))) return;
+        STATS_ADD(st_bytes, sizeof(struct ofd) * (m - mofd));
+        ofds = o;
+        mofd = m;
+    }
+    ofds[nofd].ino = sr->sr_ino;
+    ofds[nofd++].fd = sr->sr_fd;
+    hash_put(&owned, sr->sr_ino, NULL);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int owned_collect(const struct filter *f) {
+    /* With -p, -e or -c only the sockets of the chosen processes are worth taking from the tables, and none if nobody
+    passes. So their FDs are read first, while the tables are still empty and every socket comes out as SK_UNK with
+    its inode, and kept for procfs_socks() to join later */
+    struct filter all = {0};
+    struct proc_rec pr;
+    pid_t *pids = NULL;
+    uint64_t *v;
+    size_t start;
+    int npids = 0;
+
+    if (owned_on || !(f->f_npids || f->f_nuids || f->f_ncomms)) return 0;
+    if (hash_init(&owned, 1024) == -1 || hash_init(&owned_pids, 64) == -1) return -1;
+    if (f->f_npids) {
+        pids = f->f_pids;
+        npids = f->f_npids;
+    } else if (procfs_pids(&pids, &npids) == -1)
+        return -1;
+
+    all.f_want = SK_UNK;
+    for (int i = 0; i < npids; i++) {
+        if (procfs_proc(pids[i], &pr) == -1 || !proc_match(f, &pr)) continue;
+        start = nofd;
+        procfs_socks(&pr, &all, owned_put, NULL);
+        if ((v = hash_put(&owned_pids, (uint32_t)pr.pr_pid, NULL))) *v = (uint64_t)start << 32 | (nofd - start);
+    }
+
+    if (pids != f->f_pids) free(pids);
+    owned_on = 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_fdsig(pid_t pid, uint64_t *sig) {
+    /* Since Linux 6.2 st_size of /proc/<pid>/fd is the number of open descriptors; older kernels say 0. The inode of
+    the directory is new for a new process, so a reused PID does not look unchanged */
+    static int counted = -1;                                                /* Does the kernel count them? */
+    char dname[64];
+    struct stat st;
+
+    if (counted == -1) counted = stat("/proc/self/fd", &st) == 0 && st.st_size > 0;
+    if (!counted) return -1;
+
+    snprintf(dname, sizeof(dname), "/proc/%d/fd", (int)pid);
+    if (stat(dname, &st) == -1) return -1;
+    *sig = (uint64_t)(uint32_t)st.st_ino << 32 | (uint32_t)st.st_size;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int procfs_rejoin(struct sock_rec *sr) {
+    int fd = sr->sr_fd;
+    uint64_t *idx;
+
+    if (!(idx = hash_get(&inodes, sr->sr_ino))) return sr->sr_kind == SK_UNK ? 0 : -1;
+    memset(sr, 0, sizeof(*sr));
+    sr->sr_fd = fd;
+    pent_join(&ptab[*idx], sr);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void procfs_idents(void (*fn)(uint64_t ino, void *arg), void *arg) {
+    for (size_t i = 0; i < npent; i++) fn(ptab[i].ino, arg);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void procfs_fini(void) {
+    pthread_once(&dents_once, dents_key_init);
+    free(pthread_getspecific(dents_key));                                   /* Workers free theirs on exit */
+    pthread_setspecific(dents_key, NULL);
+    hash_free(&inodes);
+    hash_free(&owned); hash_free(&owned_pids); owned_on = 0;
+    free(ofds); ofds = NULL; nofd = mofd = 0;
+    free(ptab); ptab = NULL; npent = mpent = 0;
+    free(pxtab); pxtab = NULL; px_cols = 0;
+    free(paths); paths = NULL; lpaths = mpaths = 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const struct backend procfs_backend = {
+    "procfs",
+    procfs_init,
+    procfs_pids,
+    procfs_proc,
+    procfs_socks,
+    procfs_fini,
+    procfs_fdsig,
+    procfs_rejoin,
+    procfs_idents
+};
+
+const struct backend netlink_backend = {
+    "netlink",
+    netlink_init,
+    procfs_pids,
+    procfs_proc,
+    procfs_socks,
+    procfs_fini,
+    procfs_fdsig,
+    procfs_rejoin,
+    procfs_idents
+};
+
+#endif /* __linux__ */
@@ -0,0 +1,316 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat benchmarks: timing harness, wall time, syscalls and peak RSS against loadgen sockets                      */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+#include <sys/ptrace.h>
+#endif
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define MAX_SCALES      16
+#define MAX_ARGS        64
+#define SOCKS_PER_PROC  10000                                               /* Processes = sockets / this */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct run {                                                                /* One sockstat run */
+    double ms;                                                              /* Wall time */
+    long rss_kb;                                                            /* Peak RSS */
+    long rows;                                                              /* Lines of the output */
+    long syscalls;                                                          /* -1 if not counted */
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode);
+
+static pid_t load_pid = 0;                                                  /* Running loadgen */
+static int load_fd = -1;                                                    /* Its stdin, close it to stop */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void load_stop(void) {
+    if (!load_pid) return;
+    close(load_fd);
+    waitpid(load_pid, NULL, 0);
+    load_pid = 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int load_start(const char *loadgen, long socks, int *procs) {
+    /* Spread the sockets: 10% listeners, 60% established pairs, 10% UDP, 20% UNIX pairs. Returns -1 if the box can
+    not hold them, e.g. because of the open files limit */
+    char a_p[24], a_l[24], a_e[24], a_u[24], a_x[24], line[64];
+    int in[2], out[2];
+    long per;
+    ssize_t n;
+
+    *procs = socks > SOCKS_PER_PROC ? (int)(socks / SOCKS_PER_PROC) : 1;
+    per = socks / *procs;
+    snprintf(a_p, sizeof(a_p), "%d", *procs);
+    snprintf(a_l, sizeof(a_l), "%ld", per / 10);
+    snprintf(a_e, sizeof(a_e), "%ld", per * 3 / 10);
+    snprintf(a_u, sizeof(a_u), "%ld", per / 10);
+    snprintf(a_x, sizeof(a_x), "%ld", per / 10);
+
+    if (pipe(in) == -1 || pipe(out) == -1) return -1;
+    if ((load_pid = fork()) == -1) return -1;
+    if (!load_pid) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execl(loadgen, loadgen, "-p", a_p, "-l", a_l, "-e", a_e, "-u", a_u, "-x", a_x, (char *)NULL);
+        perror(loadgen);
+        _exit(1);
+    }
+    close(in[0]);
+    close(out[1]);
+    load_fd = in[1];
+
+    /* loadgen prints PIDs of its processes when all sockets are open */
+    while ((n = read(out[0], line, sizeof(line))) == -1 && errno == EINTR) ;
+    close(out[0]);
+    if (n <= 0) {
+        load_stop();
+        return -1;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static long count_rows(int fd) {
+    char buf[65536];
+    long rows = 0;
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (char *p = buf; (p = memchr(p, '\n', buf + n - p)); p++) rows++;
+    }
+    return rows;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#if defined(__linux__)
+static long trace_syscalls(pid_t pid) {
+    /* Count syscall stops of the child and all its threads. Every syscall stops twice: on entry and on exit */
+    long stops = 0;
+    pid_t tid;
+    int st, sig;
+
+    if (waitpid(pid, &st, 0) == -1 || !WIFSTOPPED(st)) return -1;           /* Stopped by exec() */
+    ptrace(PTRACE_SETOPTIONS, pid, 0, PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_EXITKILL);
+    ptrace(PTRACE_SYSCALL, pid, 0, 0);
+
+    while ((tid = waitpid(-1, &st, __WALL)) != -1) {
+        if (WIFEXITED(st) || WIFSIGNALED(st)) {
+            if (tid == pid) break;
+            continue;
+        }
+        sig = WSTOPSIG(st);
+        if (sig == (SIGTRAP | 0x80)) {
+            stops++;
+            sig = 0;
+        } else if (sig == SIGTRAP || sig == SIGSTOP)                        /* clone() events, new threads */
+            sig = 0;
+        ptrace(PTRACE_SYSCALL, tid, 0, sig);
+    }
+    return stops / 2;
+}
+#endif
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int run_once(char **argv, int trace, struct run *r) {
+    struct rusage ru;
+    int out[2], st;
+    double t0;
+    pid_t pid;
+
+    r->syscalls = -1;
+    if (pipe(out) == -1) return -1;
+    t0 = now_ms();
+    if ((pid = fork()) == -1) return -1;
+    if (!pid) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+#if defined(__linux__)
+        if (trace && ptrace(PTRACE_TRACEME, 0, 0, 0) == -1) _exit(2);
+#endif
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(1);
+    }
+    close(out[1]);
+
+#if defined(__linux__)
+    if (trace) {
+        /* The tracer can not read the pipe while it waits, so the output goes to a reader */
+        pid_t reader = fork();
+
+        if (!reader) _exit(count_rows(out[0]) < 0);
+        close(out[0]);
+        r->syscalls = trace_syscalls(pid);
+        waitpid(reader, NULL, 0);
+        return wait4(pid, &st, 0, &ru) == -1 && errno != ECHILD ? -1 : 0;
+    }
+#endif
+
+    r->rows = count_rows(out[0]);
+    close(out[0]);
+    if (wait4(pid, &st, 0, &ru) == -1 || !WIFEXITED(st) || WEXITSTATUS(st)) return -1;
+    r->ms = now_ms() - t0;
+#if defined(__APPLE__)
+    r->rss_kb = ru.ru_maxrss / 1024;                                        /* Bytes on macOS */
+#else
+    r->rss_kb = ru.ru_maxrss;
+#endif
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int ms_cmp(const void *a, const void *b) {
+    double x = ((const struct run *)a)->ms, y = ((const struct run *)b)->ms;
+
+    return x < y ? -1 : x > y;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void bench(char **argv, long socks, int procs, int runs, int trace) {
+    /* Big counts take long: fewer runs, but at least 3 */
+    struct run *r, t;
+    long rss = 0;
+    int n;
+
+    if (socks > 10000 && runs > 3) runs = runs * 10000 / socks > 3 ? (int)(runs * 10000 / socks) : 3;
+
+    if (!(r = (struct run *)calloc(runs, sizeof(struct run)))) return;
+    for (n = 0; n < runs; n++) {
+        if (run_once(argv, 0, &r[n]) == -1) break;
+        if (r[n].rss_kb > rss) rss = r[n].rss_kb;
+    }
+    if (n < runs) {
+        printf("%-8ld %-6d sockstat has failed\n", socks, procs);
+        free(r);
+        return;
+    }
+    t.syscalls = -1;
+    if (trace) run_once(argv, 1, &t);
+
+    qsort(r, runs, sizeof(struct run), ms_cmp);
+    printf("%-8ld %-6d %-8ld %-5d %-9.1f %-9.1f ", socks, procs, r[0].rows, runs, r[(runs - 1) / 2].ms,
+        r[(runs * 99 + 99) / 100 - 1].ms);                                  /* Nearest rank percentiles */
+    if (t.syscalls == -1) printf("%-9s ", "-"); else printf("%-9ld ", t.syscalls);
+    printf("%ld\n", rss);
+    fflush(stdout);
+    free(r);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int main(int argc, char* argv[]) {
+    const char *loadgen = "bench/loadgen";
+    char *sockstat = "./sockstat";
+    char *list = NULL, *t, *last = NULL;
+    long scales[MAX_SCALES] = {1000, 10000, 100000, 1000000};
+    int nscales = 4, runs = 10, trace = 1, procs, flg;
+    char *args[MAX_ARGS];
+    int nargs = 0;
+
+    while ((flg = getopt(argc, argv, "g:n:r:s:Sh")) != -1)
+        switch(flg) {
+            case 'g': loadgen = optarg; break;
+            case 'n': list = optarg; break;
+            case 'r':
+                if ((runs = atoi(optarg)) < 1) usage(1);
+            break;
+            case 's': sockstat = optarg; break;
+            case 'S': trace = 0; break;
+            case 'h': usage(0); break;
+            default: usage(1);
+        }
+
+    if (list)
+        for (nscales = 0, t = strtok_r(list, ",", &last); t && nscales < MAX_SCALES; t = strtok_r(NULL, ",", &last))
+            if ((scales[nscales++] = atol(t)) < 10) usage(1);
+
+    /* sockstat [options after --] */
+    args[nargs++] = sockstat;
+    args[nargs++] = "-q";
+    for (; optind < argc && nargs < MAX_ARGS - 1; optind++) args[nargs++] = argv[optind];
+    args[nargs] = NULL;
+
+    signal(SIGPIPE, SIG_IGN);
+    printf("%-8s %-6s %-8s %-5s %-9s %-9s %-9s %s\n",
+        "SOCKETS", "PROCS", "ROWS", "RUNS", "P50 MS", "P99 MS", "SYSCALLS", "MAXRSS KB");
+    for (int i = 0; i < nscales; i++) {
+        if (load_start(loadgen, scales[i], &procs) == -1) {
+            printf("%-8ld %-6d skipped: unable to open that many sockets here\n", scales[i], procs);
+            fflush(stdout);
+            continue;
+        }
+        bench(args, scales[i], procs, runs, trace);
+        load_stop();
+    }
+
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode) {
+    printf("Usage: bench [-Sh] [-g loadgen] [-n sockets,...] [-r runs] [-s sockstat] [-- sockstat options]\n\n\
+    -g\tLoad generator, bench/loadgen by default\n\
+    -n\tComma separated socket counts, 1000,10000,100000,1000000 by default\n\
+    -r\tRuns of sockstat for each count, 10 by default, fewer over 10000 sockets\n\
+    -s\tsockstat to benchmark, ./sockstat by default\n\
+    -S\tDo not count syscalls, Linux counts them with ptrace(2) in a separate run\n\
+    \n\
+    Scales the box can not hold, e.g. due to the open files limit, are skipped\n\n");
+
+    exit(ecode);
+}
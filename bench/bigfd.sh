@@ -0,0 +1,26 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: one process with a huge descriptor table, every socket must be listed                           #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# Usage: bench/bigfd.sh [sockets]
+#
+# bench/loadgen opens the sockets in one process, half of them TCP listeners and half UNIX pairs. sockstat must list
+# all of them, also with -N, while its peak RSS stays far below the size of the FD table.
+
+. "$(dirname "$0")/lib.sh"
+
+SOCKS=${1:-100000}
+
+loadgen_start -l $((SOCKS / 2)) -x $((SOCKS / 4)) || { echo "skipped: loadgen could not open $SOCKS sockets"; exit 0; }
+pid=$pids
+
+rc=0
+for opt in "" -N "-j4"; do
+    rows=$("$SOCKSTAT" -q -p "$pid" $opt -S 2>"$tmp.stats" | wc -l)
+    rss=$(awk '/peak RSS/ { print $3 }' "$tmp.stats")
+    if [ "$rows" -eq "$SOCKS" ]; then res=ok; else res=FAILED; rc=1; fi
+    printf "%-8s %8d of %d sockets, peak RSS %6d KB: %s\n" "${opt:-procfs}" "$rows" "$SOCKS" "$rss" "$res"
+done
+exit $rc
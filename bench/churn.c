@@ -0,0 +1,131 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat benchmarks: a process opening and closing sockets on a fixed timeline, for the -w watch mode              */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode);
+
+static struct timespec delay = {0, 500 * 1000 * 1000};                      /* Between the steps */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void die(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void step(const char *what) {
+    struct timespec ts = delay;
+
+    while (nanosleep(&ts, &ts) == -1) ;
+    printf("%s\n", what);
+    fflush(stdout);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int inet_sock(int type, int s, int want) {
+    /* A loopback socket of the type, expected to land on FD want */
+    struct sockaddr_in sa;
+    socklen_t sl = sizeof(sa);
+    int c;
+
+    if ((c = socket(AF_INET, type, 0)) == -1) die("socket");
+    if (c != want) {
+        fprintf(stderr, "Got FD %d instead of %d\n", c, want);
+        exit(1);
+    }
+    if (s == -1) {                                                          /* Listener or UDP */
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) die("bind");
+        if (type == SOCK_STREAM && listen(c, 16) == -1) die("listen");
+    } else {                                                                /* Client of the listener s */
+        if (getsockname(s, (struct sockaddr *)&sa, &sl) == -1) die("getsockname");
+        if (connect(c, (struct sockaddr *)&sa, sizeof(sa)) == -1) die("connect");
+    }
+    return c;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int main(int argc, char* argv[]) {
+    int flg, ms;
+
+    while ((flg = getopt(argc, argv, "d:h")) != -1)
+        switch(flg) {
+            case 'd':
+                if ((ms = atoi(optarg)) <= 0) usage(1);
+                delay.tv_sec = ms / 1000;
+                delay.tv_nsec = ms % 1000 * 1000000L;
+            break;
+            case 'h': usage(0); break;
+            default: usage(1);
+        }
+
+    for (int fd = 3; fd < 64; fd++) close(fd);                              /* FD numbers are what the steps say */
+
+    step("listen fd3");
+    inet_sock(SOCK_STREAM, -1, 3);
+    step("connect fd4, accept fd5");
+    inet_sock(SOCK_STREAM, 3, 4);
+    if (accept(3, NULL, NULL) != 5) die("accept");
+    step("udp fd6");
+    inet_sock(SOCK_DGRAM, -1, 6);
+    step("close fd4, fd5 goes CLOSE_WAIT");
+    close(4);
+    step("connect fd4, accept fd7");
+    inet_sock(SOCK_STREAM, 3, 4);
+    if (accept(3, NULL, NULL) != 7) die("accept");
+    step("dup2 fd6 over fd4, the same number of FDs, fd7 goes CLOSE_WAIT");
+    if (dup2(6, 4) == -1) die("dup2");
+    step("hold, fd4 must be udp4 by now");
+    step("close fd3");
+    close(3);
+    step("exit");
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode) {
+    printf("Usage: churn [-d ms]\n\n\
+    -d\tDelay between the steps, 500 ms by default\n\
+    \n\
+    Opens, changes and closes loopback sockets step by step, printing each step, then exits\n\n");
+
+    exit(ecode);
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: cost of the -p, -e, -c and -P filters against a full listing                                    #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# Usage: bench/filters.sh [procs [listeners [established]]]
+#
+# Starts bench/loadgen with the given load and times sockstat with and without filters. Filters are applied before
+# the data they do not need is collected, so a narrow filter should cost a fraction of the full listing.
+
+. "$(dirname "$0")/lib.sh"
+
+PROCS=${1:-100}
+LISTENERS=${2:-100}
+ESTABLISHED=${3:-100}
+RUNS=${RUNS:-5}
+
+loadgen_start -p "$PROCS" -l "$LISTENERS" -e "$ESTABLISHED" || { echo "loadgen has failed"; exit 1; }
+pid=${pids%% *}
+
+now() {
+    # Milliseconds; BSD date has no %N
+    perl -MTime::HiRes=time -e 'printf "%d\n", time * 1000'
+}
+
+run() {
+    # Best of $RUNS wall clock times, rows printed
+    best=
+    for i in $(seq "$RUNS"); do
+        t0=$(now)
+        rows=$("$SOCKSTAT" -q "$@" | wc -l)
+        t=$(($(now) - t0))
+        [ -z "$best" ] || [ "$t" -lt "$best" ] && best=$t
+    done
+    printf "%-24s %8d rows %8d ms\n" "${*:-(none)}" "$rows" "$best"
+}
+
+echo "$PROCS processes, $LISTENERS listeners and $ESTABLISHED connections each"
+run
+run -p "$pid"
+run -e "$(id -un)"
+run -c loadgen
+run -c no-such-command
+run -P 1
+run -l
+run -N
+run -N -p "$pid"
+run -N -P 1
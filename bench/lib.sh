@@ -0,0 +1,24 @@
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: common part of the scripts, sourced by them                                                     #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# $tmp is a prefix for temporary files: "$tmp" and "$tmp".* are removed on exit, and so is the load of
+# loadgen_start [loadgen options]. It starts bench/loadgen and waits until all sockets are open, then $pids are the
+# PIDs of its processes. Returns 1 if loadgen could not hold the load, e.g. with a low open files limit.
+
+SOCKSTAT=${SOCKSTAT:-./sockstat}
+LOADGEN=${LOADGEN:-bench/loadgen}
+
+tmp=$(mktemp -u /tmp/sockstat-bench.XXXXXX)
+trap 'exec 3>&-; rm -f "$tmp" "$tmp".*' EXIT INT TERM
+
+loadgen_start() {
+    mkfifo "$tmp" || return 1
+    "$LOADGEN" "$@" < "$tmp" > "$tmp.pids" &
+    exec 3> "$tmp"                                                      # loadgen lives until this is closed
+    while [ ! -s "$tmp.pids" ]; do
+        kill -0 $! 2>/dev/null || return 1
+        sleep 0.1
+    done
+    pids=$(cat "$tmp.pids")
+}
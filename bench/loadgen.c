@@ -0,0 +1,197 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat benchmarks: synthetic socket load generator                                                               */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define PORTS_PER_ADDR  16384                                               /* Stay below the ephemeral range */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode);
+
+static unsigned long nport = 0;                                             /* Ephemeral ports taken, for addr() */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void die(const char *msg) {
+    perror(msg);
+    exit(1);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct sockaddr_in *addr(struct sockaddr_in *sa, int port) {
+    /* Loopback address for the next ephemeral port: Linux answers on the whole 127/8, so move on to 127.0.0.2 and
+    further when too many ports are taken on one address */
+    unsigned long a = port ? 1 : 1 + nport++ / PORTS_PER_ADDR;
+
+    memset(sa, 0, sizeof(*sa));
+    sa->sin_family = AF_INET;
+    sa->sin_addr.s_addr = htonl(0x7f000000 | (a & 0xffffff));
+    sa->sin_port = htons(port);
+    return sa;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int tcp_listener(void) {
+    struct sockaddr_in sa;
+    int s;
+
+    if ((s = socket(AF_INET, SOCK_STREAM, 0)) == -1) die("socket");
+    if (bind(s, (struct sockaddr *)addr(&sa, 0), sizeof(sa)) == -1) die("bind");
+    if (listen(s, 1024) == -1) die("listen");
+    return s;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void child(int listeners, int established, int udp, int unix_pairs, unsigned long first_port) {
+    /* Open everything and sleep until killed */
+    struct sockaddr_in sa, la;
+    socklen_t sl = sizeof(la);
+    int s, c, a, sp[2];
+
+    nport = first_port;
+    for (int i = 0; i < listeners; i++) tcp_listener();
+
+    if (established) {
+        s = tcp_listener();
+        if (getsockname(s, (struct sockaddr *)&la, &sl) == -1) die("getsockname");
+        for (int i = 0; i < established; i++) {
+            if ((c = socket(AF_INET, SOCK_STREAM, 0)) == -1) die("socket");
+            if (bind(c, (struct sockaddr *)addr(&sa, 0), sizeof(sa)) == -1) die("bind");
+            if (connect(c, (struct sockaddr *)&la, sizeof(la)) == -1) die("connect");
+            if ((a = accept(s, NULL, NULL)) == -1) die("accept");
+        }
+    }
+
+    for (int i = 0; i < udp; i++) {
+        if ((s = socket(AF_INET, SOCK_DGRAM, 0)) == -1) die("socket");
+        if (bind(s, (struct sockaddr *)addr(&sa, 0), sizeof(sa)) == -1) die("bind");
+    }
+
+    for (int i = 0; i < unix_pairs; i++)
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sp) == -1) die("socketpair");
+
+    (void)a;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void nofile(rlim_t need) {
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1) die("getrlimit");
+    if (rl.rlim_cur >= need) return;
+    if (rl.rlim_max < need) rl.rlim_max = need;                             /* Only root may raise it */
+    rl.rlim_cur = need;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1) {
+        fprintf(stderr, "Unable to raise the open files limit to %llu: %s\n", (unsigned long long)need,
+            strerror(errno));
+        exit(1);
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int main(int argc, char* argv[]) {
+    int procs = 1, listeners = 0, established = 0, udp = 0, unix_pairs = 0;
+    unsigned long per_child;
+    int flg, ready[2];
+    pid_t *kids;
+    char c;
+
+    while ((flg = getopt(argc, argv, "p:l:e:u:x:h")) != -1)
+        switch(flg) {
+            case 'p': procs = atoi(optarg); break;
+            case 'l': listeners = atoi(optarg); break;
+            case 'e': established = atoi(optarg); break;
+            case 'u': udp = atoi(optarg); break;
+            case 'x': unix_pairs = atoi(optarg); break;
+            case 'h': usage(0); break;
+            default: usage(1);
+        }
+    if (procs < 1 || listeners < 0 || established < 0 || udp < 0 || unix_pairs < 0) usage(1);
+
+    nofile(16 + listeners + 1 + established * 2 + udp + unix_pairs * 2);
+    per_child = listeners + 1 + established + udp;                          /* Ephemeral ports per child */
+
+    if (!(kids = (pid_t *)calloc(procs, sizeof(pid_t)))) die("calloc");
+    if (pipe(ready) == -1) die("pipe");
+
+    for (int i = 0; i < procs; i++) {
+        if ((kids[i] = fork()) == -1) die("fork");
+        if (!kids[i]) {
+            close(ready[0]);
+            child(listeners, established, udp, unix_pairs, per_child * i);
+            if (write(ready[1], "", 1) != 1) die("write");
+            close(ready[1]);
+            for (;;) pause();
+        }
+    }
+    close(ready[1]);
+
+    /* Wait until all children are done, then tell who they are */
+    for (int i = 0; i < procs; i++)
+        if (read(ready[0], &c, 1) != 1) {
+            fprintf(stderr, "A child has failed\n");
+            for (int k = 0; k < procs; k++) kill(kids[k], SIGKILL);
+            exit(1);
+        }
+    for (int i = 0; i < procs; i++) printf("%s%d", i ? " " : "", (int)kids[i]);
+    printf("\n");
+    fflush(stdout);
+
+    /* Hold the load until stdin is closed */
+    while (read(STDIN_FILENO, &c, 1) > 0) ;
+    for (int i = 0; i < procs; i++) kill(kids[i], SIGKILL);
+    while (wait(NULL) > 0 || errno == EINTR) ;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void usage(int ecode) {
+    printf("Usage: loadgen [-p procs] [-l listeners] [-e established] [-u udp] [-x unix]\n\n\
+    -p\tNumber of processes holding sockets, 1 by default\n\
+    -l\tTCP listeners per process\n\
+    -e\tEstablished TCP loopback connections per process, both ends\n\
+    -u\tUDP sockets per process\n\
+    -x\tUNIX socket pairs per process\n\
+    \n\
+    Prints PIDs of the processes when all sockets are open and keeps them until stdin is closed\n\n");
+
+    exit(ecode);
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: the -j parallel scan must print exactly what the single-threaded one does                       #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# Usage: bench/parallel.sh [procs [listeners [established]]]
+#
+# bench/loadgen holds a steady load in many processes, so the PID blocks of -j 16 finish out of order. Rows of the
+# loadgen processes with -j 1 and -j 16 are compared byte by byte; -c loadgen leaves out sockstat's own row, whose
+# PID is different on every run.
+
+. "$(dirname "$0")/lib.sh"
+
+PROCS=${1:-64}
+LISTENERS=${2:-50}
+ESTABLISHED=${3:-50}
+
+loadgen_start -p "$PROCS" -l "$LISTENERS" -e "$ESTABLISHED" -u 20 -x 20 ||
+    { echo "skipped: loadgen could not start $PROCS processes"; exit 0; }
+
+rc=0
+for opt in "" -N; do
+    "$SOCKSTAT" -q -c loadgen $opt -j 1 > "$tmp.j1"
+    "$SOCKSTAT" -q -c loadgen $opt -j 16 > "$tmp.j16"
+    rows=$(wc -l < "$tmp.j1")
+    if [ "$rows" -gt 0 ] && cmp -s "$tmp.j1" "$tmp.j16"; then res=ok; else res=FAILED; rc=1; fi
+    printf "%-8s -j 1 vs -j 16, %d rows: %s\n" "${opt:-procfs}" "$rows" "$res"
+done
+exit $rc
@@ -0,0 +1,74 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: -i must replay a snapshot as it was and reject broken ones without a crash                      #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# Usage: bench/snapshot.sh [corruptions]
+#
+# A snapshot of the bench/loadgen sockets must replay as the live listing. Then it is cut at every length, which
+# sockstat -i must reject, and random bytes are written at random offsets, which it may show or reject, but must not
+# crash on. Build with CFLAGS="-g -fsanitize=address,undefined" to catch bad reads and undefined behaviour that do not
+# crash. The file is mapped, so a read past its end shows only where the next page is not mapped: the record type only
+# cases end the file with a type on the last byte of a page.
+
+. "$(dirname "$0")/lib.sh"
+
+CORRUPT=${1:-300}
+
+loadgen_start -p 2 -l 3 -e 3 -u 2 -x 2 || { echo "loadgen has failed"; exit 1; }
+
+check() {
+    # $1 is rejected (reject) or at least does not crash (any)
+    "$SOCKSTAT" -q -i "$1" > /dev/null 2> "$tmp.err"
+    rc=$?
+    [ $rc -le 1 ] && ! grep -q "ERROR: AddressSanitizer\|runtime error" "$tmp.err" || return 1
+    [ "$2" = any ] || [ $rc -eq 1 ]
+}
+
+result() {
+    if [ "$2" -eq 0 ]; then res=ok; else res=FAILED; rc_all=1; fi
+    printf "%-40s %s\n" "$1" "$res"
+}
+
+rc_all=0
+"$SOCKSTAT" -q -c loadgen > "$tmp.live"
+"$SOCKSTAT" -c loadgen -o "$tmp.snap"
+"$SOCKSTAT" -q -i "$tmp.snap" > "$tmp.replay"
+cmp -s "$tmp.live" "$tmp.replay"
+result "replay of $(wc -l < "$tmp.live") rows" $?
+
+fail=0
+: > "$tmp.bad"
+check "$tmp.bad" reject || fail=1
+check "$0" reject || fail=1                                             # Not a snapshot at all
+page=$(getconf PAGESIZE)
+for t in P S; do
+    # Records start on the last byte of the page
+    { printf 'SKST\002\000'; printf "\\$(printf %03o $(((page - 1) % 256)))\\$(printf %03o $(((page - 1) / 256)))"
+      head -c $((page - 9)) /dev/zero; printf $t; } > "$tmp.bad"
+    check "$tmp.bad" reject || fail=1
+done
+result "empty, foreign and record type only" $fail
+
+fail=0
+size=$(wc -c < "$tmp.snap")
+n=0
+while [ $n -lt "$size" ]; do
+    head -c $n "$tmp.snap" > "$tmp.bad"
+    check "$tmp.bad" reject || { echo "cut at $n bytes"; fail=1; }
+    n=$((n + 1))
+done
+result "cut at each of $size bytes" $fail
+
+fail=0
+i=0
+while [ $i -lt "$CORRUPT" ]; do
+    cp "$tmp.snap" "$tmp.bad"
+    set -- $(awk -v seed=$i -v size="$size" 'BEGIN { srand(seed); print int(rand() * size), int(rand() * 256) }')
+    printf "\\$(printf %03o "$2")" | dd of="$tmp.bad" bs=1 seek="$1" conv=notrunc 2>/dev/null
+    check "$tmp.bad" any || { echo "byte $2 at $1"; fail=1; }
+    i=$((i + 1))
+done
+result "$CORRUPT random corruptions" $fail
+exit $rc_all
@@ -0,0 +1,68 @@
+#!/bin/sh
+
+# -------------------------------------------------------------------------------------------------------------------- #
+# sockstat benchmarks: -w must print every socket opened, closed or changed by a process while it is watched           #
+# -------------------------------------------------------------------------------------------------------------------- #
+
+# Usage: bench/watch.sh [delay_ms]
+#
+# bench/churn opens TCP listeners, connections and UDP sockets step by step, closes some of them, which turns the
+# accepted ends to CLOSE_WAIT, and replaces a TCP socket with dup2(), keeping the number of FDs. The "+", "-" and "~"
+# events of sockstat -w -t are compared with the steps, regardless of the order within a tick. The UDP socket must
+# show up at fd4 before the next step, as nothing else tells that the FD table has changed. No row is dropped.
+
+. "$(dirname "$0")/lib.sh"
+
+CHURN=${CHURN:-bench/churn}
+DELAY=${1:-400}
+
+sort > "$tmp.want" <<END
++ 3 tcp4
++ 4 tcp4
++ 5 tcp4
++ 6 udp4
+~ 5 tcp4 ESTABLISHED->CLOSE_WAIT
+- 4 tcp4
++ 4 tcp4
++ 7 tcp4
+- 4 tcp4
++ 4 udp4
+~ 7 tcp4 ESTABLISHED->CLOSE_WAIT
+- 3 tcp4
+- 4 udp4
+- 5 tcp4
+- 6 udp4
+- 7 tcp4
+END
+
+events() {
+    # EV USER PID COMMAND FD PROTO LOCAL REMOTE [STATES] => EV FD PROTO [STATES]. A tick may catch a socket before
+    # bind() or connect() put it into the tables, or between reading the tables and the FDs: it is "+ unk" then and
+    # "~" with the protocol on the next tick, which makes one "+". A "-" of it or an "unk" left over is a failure
+    awk -F'\t' '{ sub(/ +$/, "", $5) }
+        $1 == "+" && $6 == "unk" { unk[$5] = 1; next }
+        $1 == "~" && ($5 in unk) && $9 == "" { delete unk[$5]; print "+", $5, $6; next }
+        { print $1, $5, $6 ($9 == "" ? "" : " " $9) }
+        END { for (fd in unk) print "+", fd, "unk" }' "$1"
+}
+
+rc=0
+for opt in "" -N; do
+    : > "$tmp.steps"
+    "$CHURN" -d "$DELAY" > "$tmp.steps" &
+    churn=$!
+    "$SOCKSTAT" -q -w 0.1 -t -p "$churn" $opt > "$tmp" &
+    watch=$!
+    while ! grep -q '^hold' "$tmp.steps" && kill -0 "$churn" 2>/dev/null; do sleep 0.1; done
+    events "$tmp" | grep -q '^+ 4 udp4$' && dup2=ok || dup2=late
+    wait "$churn"
+    sleep 0.5                                                           # The last tick sees it gone
+    kill "$watch"
+    wait "$watch" 2>/dev/null
+
+    events "$tmp" | sort > "$tmp.got"
+    if [ $dup2 = ok ] && cmp -s "$tmp.want" "$tmp.got"; then res=ok; else res=FAILED; rc=1; fi
+    printf "%-8s %d events, dup2 %s: %s\n" "${opt:-procfs}" "$(wc -l < "$tmp.got")" "$dup2" "$res"
+    [ $res = ok ] || diff "$tmp.want" "$tmp.got"
+done
+exit $rc
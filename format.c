@@ -0,0 +1,410 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: output formatting without printf                                                                         */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <pwd.h>
+#include <pthread.h>
+
+#include "sockstat.h"
+#include "hash.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define ROW_SLACK       256                                                 /* Everything in a row but strings */
+#define CX_MAXCOLS      6
+#define CX_SLACK        (CX_MAXCOLS * 16)                                   /* -O columns of a row */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static struct hash unames;                                                  /* UID => user name cache */
+static pthread_mutex_t unames_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char hexdigits[] = "0123456789abcdef";
+
+static const struct {
+    const char *name;
+    int col;
+    const char *title;
+} cx_names[] = {
+    {"sendq", CX_SENDQ, "SEND-Q"}, {"recvq", CX_RECVQ, "RECV-Q"}, {"rtt", CX_RTT, "RTT-MS"},
+    {"retrans", CX_RETRANS, "RETRANS"}, {"cwnd", CX_CWND, "CWND"}, {"state", CX_STATE, "STATE"}
+};
+
+static int cx_cols[CX_MAXCOLS];                                             /* -O, in the order given */
+static int cx_ncols = 0;
+
+static const char *tcp_states[] = {                                         /* TS_* => name */
+    "UNKNOWN", "CLOSED", "LISTEN", "SYN_SENT", "SYN_RECEIVED", "ESTABLISHED", "CLOSE_WAIT", "FIN_WAIT_1",
+    "CLOSING", "LAST_ACK", "FIN_WAIT_2", "TIME_WAIT"
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* All put_*() write at the cursor p and return the new cursor. The caller reserves the room beforehand               */
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_str(char *p, const char *s) {
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_pad(char *p, const char *s, int width) {
+    /* printf("%-*s") */
+    while (*s) { *p++ = *s++; width--; }
+    while (width-- > 0) *p++ = ' ';
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_uint(char *p, unsigned long long v) {
+    char tmp[20];
+    int n = 0;
+
+    do { tmp[n++] = '0' + v % 10; v /= 10; } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_int(char *p, long long v, int width) {
+    /* printf("%-*d") */
+    char *s = p;
+
+    if (v < 0) {
+        *p++ = '-';
+        p = put_uint(p, -(unsigned long long)v);
+    } else
+        p = put_uint(p, v);
+    for (width -= p - s; width > 0; width--) *p++ = ' ';
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_hex(char *p, unsigned long long v) {
+    /* printf("%llx") */
+    char tmp[16];
+    int n = 0;
+
+    do { tmp[n++] = hexdigits[v & 0xf]; v >>= 4; } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_ip4(char *p, const void *addr) {
+    /* inet_ntop(AF_INET) */
+    const uint8_t *a = (const uint8_t *)addr;
+
+    for (int i = 0; i < 4; i++) {
+        if (i) *p++ = '.';
+        p = put_uint(p, a[i]);
+    }
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_ip6(char *p, const void *addr) {
+    /* inet_ntop(AF_INET6): the longest run of 2+ zero words becomes "::", IPv4 mapped/compatible are dotted */
+    const uint8_t *a = (const uint8_t *)addr;
+    int base = -1, len = 0, cbase = -1, clen = 0;
+    uint16_t w[8];
+
+    for (int i = 0; i < 8; i++) {
+        w[i] = (uint16_t)(a[i * 2] << 8 | a[i * 2 + 1]);
+        if (!w[i]) {
+            if (cbase == -1) { cbase = i; clen = 1; } else clen++;
+            if (clen > len) { base = cbase; len = clen; }
+        } else
+            cbase = -1;
+    }
+    if (len < 2) base = -1;
+
+    for (int i = 0; i < 8; i++) {
+        if (base != -1 && i >= base && i < base + len) {
+            if (i == base) *p++ = ':';
+            continue;
+        }
+        if (i) *p++ = ':';
+        if (i == 6 && base == 0 &&
+            (len == 6 || (len == 5 && w[5] == 0xffff)
+#if defined(__APPLE__)
+            || (len == 7 && w[7] != 0x0001)                                 /* BSD libc flavour */
+#endif
+            ))
+            return put_ip4(p, a + 12);
+        p = put_hex(p, w[i]);
+    }
+    if (base != -1 && base + len == 8) *p++ = ':';
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const char *uid_name(uid_t uid) {
+    /* getpwuid() may go to NSS/LDAP, so ask it once per UID. Unknown UIDs are shown as numbers */
+    static __thread const char *last_name = NULL;                           /* Sockets come in bunches per process */
+    static __thread uid_t last_uid;
+    struct passwd pw, *pwd = NULL;
+    char *pwbuf = NULL, *b, num[24];
+    long size = sysconf(_SC_GETPW_R_SIZE_MAX);                              /* Only a hint, -1 if none */
+    uint64_t *v;
+    int isnew = 0;
+
+    if (last_name && last_uid == uid) return last_name;
+
+    pthread_mutex_lock(&unames_lock);
+    if (!unames.size) hash_init(&unames, 64);
+    if ((v = hash_put(&unames, uid, &isnew)) && isnew) {
+        STATS_ENTER(ST_NAMES);
+        if (size <= 0) size = 1024;
+        /* Big groups or LDAP entries may not fit: grow the buffer on ERANGE */
+        while ((b = (char *)realloc(pwbuf, size))) {
+            pwbuf = b;
+            if (getpwuid_r(uid, &pw, pwbuf, size, &pwd) != ERANGE) break;
+            size *= 2;
+        }
+        STATS_LEAVE();
+        if (!pwd) *put_uint(num, uid) = '\0';
+        *v = (uint64_t)(uintptr_t)strdup(pwd ? pwd->pw_name : num);
+        free(pwbuf);
+    }
+    last_name = v && *v ? (const char *)(uintptr_t)*v : "?";
+    last_uid = uid;
+    pthread_mutex_unlock(&unames_lock);
+
+    return last_name;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void uid_name_set(uid_t uid, const char *name) {
+    /* Prefill the cache, e.g. with names recorded on another host. The first name of a UID wins */
+    uint64_t *v;
+    int isnew = 0;
+
+    pthread_mutex_lock(&unames_lock);
+    if (!unames.size) hash_init(&unames, 64);
+    if ((v = hash_put(&unames, uid, &isnew)) && isnew) *v = (uint64_t)(uintptr_t)strdup(name);
+    pthread_mutex_unlock(&unames_lock);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_inet(char *p, const char *proto, const struct sock_rec *sr) {
+    /* "\ttcp4\t127.0.0.1:80", "*" for a wildcard local address */
+    int v6 = sr->sr_kind & (SK_TCP6 | SK_UDP6);
+
+    p = put_str(p, proto);
+    if (v6 ? IN6_IS_ADDR_UNSPECIFIED(&sr->sr_laddr) : ((const struct in_addr *)&sr->sr_laddr)->s_addr == INADDR_ANY)
+        *p++ = '*';
+    else
+        p = v6 ? put_ip6(p, &sr->sr_laddr) : put_ip4(p, &sr->sr_laddr);
+    *p++ = ':';
+    if (sr->sr_lport) p = put_uint(p, sr->sr_lport); else *p++ = '*';
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const char *tcp_state_name(int state) {
+    return state >= 0 && state < (int)(sizeof(tcp_states) / sizeof(tcp_states[0])) ? tcp_states[state] : "UNKNOWN";
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const char *kind_name(int kind) {
+    switch (kind) {
+        case SK_TCP4: return "tcp4";
+        case SK_TCP6: return "tcp6";
+        case SK_UDP4: return "udp4";
+        case SK_UDP6: return "udp6";
+        case SK_UNIX: return "unix";
+        case SK_ROUTE: return "route";
+        case SK_NDRV: return "ndrv";
+        case SK_KEVT: return "kevt";
+        case SK_KCTL: return "kctl";
+        case SK_SUNKN: return "sunkn";
+        default: return "unk";
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int cols_init(char *cols) {
+    /* -O col[,col...]. Returns CX_* of the columns or -1 on an unknown one */
+    char *t, *last = NULL;
+    int want = 0;
+    size_t i;
+
+    for (t = strtok_r(cols, ",", &last); t; t = strtok_r(NULL, ",", &last)) {
+        for (i = 0; i < sizeof(cx_names) / sizeof(cx_names[0]) && strcmp(t, cx_names[i].name); i++) ;
+        if (i == sizeof(cx_names) / sizeof(cx_names[0]) || want & cx_names[i].col) return -1;
+        cx_cols[cx_ncols++] = cx_names[i].col;
+        want |= cx_names[i].col;
+    }
+    return want ? want : -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void cols_header(void) {
+    for (int i = 0; i < cx_ncols; i++)
+        for (size_t j = 0; j < sizeof(cx_names) / sizeof(cx_names[0]); j++)
+            if (cx_names[j].col == cx_cols[i]) printf("\t%s", cx_names[j].title);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static char *put_cols(char *p, const struct sock_rec *sr) {
+    /* -O columns, "-" for what the backend could not tell */
+    for (int i = 0; i < cx_ncols; i++) {
+        *p++ = '\t';
+        if (cx_cols[i] == CX_STATE) {
+            p = put_str(p, sr->sr_kind & SK_TCP ? tcp_state_name(sr->sr_state) : "-");
+            continue;
+        }
+        if (!(sr->sr_ext & cx_cols[i])) {
+            *p++ = '-';
+            continue;
+        }
+        switch (cx_cols[i]) {
+            case CX_SENDQ: p = put_uint(p, sr->sr_sendq); break;
+            case CX_RECVQ: p = put_uint(p, sr->sr_recvq); break;
+            case CX_RTT:
+                p = put_uint(p, sr->sr_rtt / 1000);
+                *p++ = '.';
+                for (uint32_t d = 100; d; d /= 10) *p++ = '0' + sr->sr_rtt / d % 10;
+            break;
+            case CX_RETRANS: p = put_uint(p, sr->sr_retrans); break;
+            case CX_CWND: p = put_uint(p, sr->sr_cwnd); break;
+        }
+    }
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int sock_format(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob) {
+    /* Append the output line to the buffer. Returns 0 if there is nothing to show */
+    const char *uname = uid_name(pr->pr_uid);
+    char *p;
+
+    if (obuf_grow(ob, strlen(uname) + sizeof(pr->pr_comm) + sizeof(sr->sr_path) + sizeof(sr->sr_cpath) +
+        sizeof(sr->sr_pcomm) + ROW_SLACK + CX_SLACK) == -1)
+        return 0;
+    p = ob->ob_buf + ob->ob_len;
+
+    p = put_pad(p, uname, 23); *p++ = '\t';
+    p = put_int(p, pr->pr_pid, 5); *p++ = '\t';
+    p = put_pad(p, pr->pr_comm, 31); *p++ = '\t';
+    p = put_int(p, sr->sr_fd, 3);
+
+    switch (sr->sr_kind) {
+        case SK_TCP4:
+        case SK_TCP6:
+            /* Local address and port */
+            if (sr->sr_lport) p = put_inet(p, sr->sr_kind == SK_TCP4 ? "\ttcp4\t" : "\ttcp6\t", sr);
+            /* Remote address and port */
+            if (sr->sr_fport) {
+                *p++ = '\t';
+                p = sr->sr_kind == SK_TCP4 ? put_ip4(p, &sr->sr_faddr) : put_ip6(p, &sr->sr_faddr);
+                *p++ = ':';
+                p = put_uint(p, sr->sr_fport);
+            } else
+                p = put_str(p, "\t*:*");                                    /* No port - no address */
+        break;
+
+        case SK_UDP4:
+        case SK_UDP6:
+            p = put_inet(p, sr->sr_kind == SK_UDP4 ? "\tudp4\t" : "\tudp6\t", sr);
+            p = put_str(p, "\t*:*");                                        /* UDP is stateless protocol */
+        break;
+
+        case SK_UNIX: /* aka LOCAL socket */
+            p = put_str(p, "\tunix\t");
+            /* Bound address */
+            if (sr->sr_path[0])
+                p = put_str(p, sr->sr_path);
+            else {
+                p = put_str(p, "0x");
+                p = put_hex(p, sr->sr_pcb);
+            }
+            /* Address of socket connected to, then the peer's owner if -x found it: "/tmp/x.sock->123/cmd" */
+            *p++ = '\t';
+            p = put_str(p, sr->sr_cpath);
+            if (sr->sr_ppid) {
+                p = put_str(p, "->");
+                p = put_int(p, sr->sr_ppid, 0);
+                *p++ = '/';
+                p = put_str(p, sr->sr_pcomm);
+            } else if (!sr->sr_cpath[0])
+                p = put_str(p, "->??");
+        break;
+
+        case SK_ROUTE: /* Not much info, do we need more? */
+            p = put_str(p, "\troute\t0x");
+            p = put_hex(p, sr->sr_pcb);
+        break;
+
+        case SK_NDRV:
+            p = put_str(p, "\tndrv\tunit: ");
+            p = put_int(p, (int)sr->sr_u[0], 0);
+            p = put_str(p, " name: ");
+            p = put_str(p, sr->sr_path);
+        break;
+
+        case SK_KEVT:
+            p = put_str(p, "\tkevt\t0x");
+            p = put_hex(p, sr->sr_pcb);
+            p = put_str(p, " evt: 0x");
+            p = put_hex(p, sr->sr_u[0]);
+            p = put_str(p, ":0x");
+            p = put_hex(p, sr->sr_u[1]);
+            p = put_str(p, ":0x");
+            p = put_hex(p, sr->sr_u[2]);
+        break;
+
+        case SK_KCTL:
+            p = put_str(p, "\tkctl\t0x");
+            p = put_hex(p, sr->sr_pcb);
+            p = put_str(p, " ctl: ");
+            p = put_str(p, sr->sr_path);
+            p = put_str(p, " id: ");
+            p = put_int(p, (int)sr->sr_u[0], 0);
+            p = put_str(p, " unit: ");
+            p = put_int(p, (int)sr->sr_u[1], 0);
+        break;
+
+        case SK_SUNKN: /* May this ever happen? */
+            p = put_str(p, "\tsunkn");
+        break;
+
+        default:
+            p = put_str(p, "\tunk");
+        break;
+    }
+
+    if (cx_ncols) p = put_cols(p, sr);
+    *p++ = '\n';
+    ob->ob_len = p - ob->ob_buf;
+    return 1;
+}
@@ -0,0 +1,122 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: a tiny u64 => u64 open addressing hash table                                                             */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "sockstat.h"
+#include "hash.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static size_t hash_slot(uint64_t key, size_t size) {
+    /* splitmix64 finalizer: inodes and PIDs are sequential, spread them over the table */
+    key ^= key >> 30; key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27; key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return (size_t)key & (size - 1);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int hash_init(struct hash *h, size_t hint) {
+    size_t size = 64;
+
+    while (size < hint * 2) size <<= 1;                                     /* Keep load factor below 1/2 */
+    h->tab = (struct hent *)malloc(sizeof(struct hent) * size);
+    h->used = (uint8_t *)calloc(size, 1);
+    if (!h->tab || !h->used) {
+        free(h->tab); free(h->used);
+        h->tab = NULL; h->used = NULL; h->size = h->count = 0;
+        return -1;
+    }
+    h->size = size;
+    h->count = 0;
+    STATS_ADD(st_bytes, (sizeof(struct hent) + 1) * size);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+uint64_t *hash_get(const struct hash *h, uint64_t key) {
+    size_t i;
+
+    if (!h->size) return NULL;
+    for (i = hash_slot(key, h->size); h->used[i]; i = (i + 1) & (h->size - 1))
+        if (h->tab[i].key == key) return &h->tab[i].val;
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int hash_grow(struct hash *h) {
+    struct hash n;
+
+    if (hash_init(&n, h->size) == -1) return -1;                            /* hint * 2 => twice as big */
+    for (size_t i = 0; i < h->size; i++)
+        if (h->used[i]) {
+            size_t j = hash_slot(h->tab[i].key, n.size);
+
+            while (n.used[j]) j = (j + 1) & (n.size - 1);
+            n.used[j] = 1;
+            n.tab[j] = h->tab[i];
+        }
+    n.count = h->count;
+    hash_free(h);
+    *h = n;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+uint64_t *hash_put(struct hash *h, uint64_t key, int *isnew) {
+    size_t i;
+
+    if ((h->count + 1) * 2 > h->size && hash_grow(h) == -1) return NULL;
+    for (i = hash_slot(key, h->size); h->used[i]; i = (i + 1) & (h->size - 1))
+        if (h->tab[i].key == key) {
+            if (isnew) *isnew = 0;
+            return &h->tab[i].val;
+        }
+    h->used[i] = 1;
+    h->tab[i].key = key;
+    h->tab[i].val = 0;
+    h->count++;
+    if (isnew) *isnew = 1;
+    return &h->tab[i].val;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void hash_clear(struct hash *h) {
+    if (h->used) memset(h->used, 0, h->size);
+    h->count = 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void hash_free(struct hash *h) {
+    free(h->tab);
+    free(h->used);
+    h->tab = NULL;
+    h->used = NULL;
+    h->size = h->count = 0;
+}
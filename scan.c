@@ -0,0 +1,259 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: process scan driver, optionally parallel                                                                 */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <pthread.h>
+
+#include "sockstat.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define SCAN_BLOCK      16                                                  /* PIDs per job */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct job {                                                                /* A block of PIDs and its output */
+    struct scan *s;
+    struct obuf *ob;                                                        /* Own buffer or directly scan's one */
+    struct obuf own;
+    int done;
+};
+
+struct scan {
+    const struct backend *be;
+    const struct filter *f;
+    const pid_t *pids;
+    int npids;
+    sink_fn sink;                                                           /* Socket => text in the job's buffer */
+    const void *sink_arg;
+    struct job *jobs;
+    int njobs;
+    struct obuf out;                                                        /* Finished jobs waiting for drain() */
+    drain_fn drain;                                                         /* Consumes the output */
+    void *drain_arg;
+    int direct;                                                             /* Single thread: may flush any time */
+    int next;                                                               /* Next job to take */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;                                                    /* A job is done */
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int obuf_grow(struct obuf *ob, size_t need) {
+    size_t size = ob->ob_size ? ob->ob_size : 4096;
+    char *b;
+
+    if (ob->ob_len + need <= ob->ob_size) return 0;
+    while (size < ob->ob_len + need) size *= 2;
+    if (!(b = (char *)realloc(ob->ob_buf, size))) return -1;
+    STATS_ADD(st_bytes, size - ob->ob_size);
+    ob->ob_buf = b;
+    ob->ob_size = size;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int obuf_put(struct obuf *ob, const char *s, size_t l) {
+    if (!l) return 0;                                                       /* Nothing to copy, maybe no buffer yet */
+    if (obuf_grow(ob, l) == -1) return -1;
+    memcpy(ob->ob_buf + ob->ob_len, s, l);
+    ob->ob_len += l;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int obuf_flush(struct obuf *ob, int fd) {
+    /* One write(2) for the whole buffer, unless the kernel takes less */
+    size_t off = 0;
+    ssize_t n;
+    int ret = 0;
+
+    STATS_ENTER(ST_OUTPUT);
+    while (off < ob->ob_len) {
+        n = write(fd, ob->ob_buf + off, ob->ob_len - off);
+        STATS_ADD(st_syscalls, 1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        off += n;
+    }
+    ob->ob_len = 0;
+    STATS_LEAVE();
+    return ret;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int drain_fd(struct obuf *ob, void *arg) {
+    return obuf_flush(ob, *(int *)arg);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int drain_mem(struct obuf *ob, void *arg) {
+    /* Keep the output in memory: arg is another obuf */
+    int r = obuf_put((struct obuf *)arg, ob->ob_buf, ob->ob_len);
+
+    ob->ob_len = 0;
+    return r;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void obuf_free(struct obuf *ob) {
+    free(ob->ob_buf);
+    ob->ob_buf = NULL;
+    ob->ob_len = ob->ob_size = 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void job_emit(const struct proc_rec *pr, const struct sock_rec *sr, void *arg) {
+    struct job *j = (struct job *)arg;
+
+    STATS_ADD(st_socks, 1);
+    STATS_ENTER(ST_FORMAT);
+    j->s->sink(pr, sr, j->ob, j->s->sink_arg);
+    STATS_LEAVE();
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void job_run(struct scan *s, int n) {
+    struct proc_rec pr;
+    int last = (n + 1) * SCAN_BLOCK < s->npids ? (n + 1) * SCAN_BLOCK : s->npids;
+
+    int r;
+
+    for (int i = n * SCAN_BLOCK; i < last; i++) {
+        /* a PIDs => PID => FDs => sockets */
+        STATS_ENTER(ST_PROC);
+        r = s->be->proc(s->pids[i], &pr);
+        STATS_LEAVE();
+        if (r == -1) continue;
+        STATS_ADD(st_procs, 1);
+        if (!proc_match(s->f, &pr)) continue;                               /* Before any FD is enumerated */
+        STATS_ENTER(ST_FDS);
+        s->be->socks(&pr, s->f, job_emit, &s->jobs[n]);
+        STATS_LEAVE();
+        if (s->direct && s->out.ob_len >= OBUF_FLUSH) s->drain(&s->out, s->drain_arg);
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void *worker(void *arg) {
+    struct scan *s = (struct scan *)arg;
+    int n;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        n = s->next++;
+        pthread_mutex_unlock(&s->lock);
+        if (n >= s->njobs) break;
+
+        job_run(s, n);
+
+        pthread_mutex_lock(&s->lock);
+        s->jobs[n].done = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int scan_pids(const struct backend *be, const struct filter *f, pid_t **pids, int *npids) {
+    /* With -p there is no need to list all processes of the system */
+    int r = 0;
+
+    STATS_ENTER(ST_PIDS);
+    if (!f->f_npids)
+        r = be->pids(pids, npids);
+    else if ((*pids = (pid_t *)malloc(sizeof(pid_t) * f->f_npids))) {
+        memcpy(*pids, f->f_pids, sizeof(pid_t) * f->f_npids);
+        *npids = f->f_npids;
+    } else
+        r = -1;
+    STATS_LEAVE();
+    return r;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int scan_run(const struct backend *be, const struct filter *f, const pid_t *pids, int npids, int nthreads,
+    sink_fn sink, const void *sink_arg, drain_fn drain, void *drain_arg) {
+    /* Workers take blocks of PIDs and format rows into per-block buffers. The buffers are written in PID order as
+    soon as they are ready, so the output is the same whatever the number of threads is */
+    struct scan s = {0};
+    pthread_t *tids = NULL;
+    int nt = 0;
+
+    s.be = be; s.f = f; s.pids = pids; s.npids = npids; s.sink = sink; s.sink_arg = sink_arg;
+    s.drain = drain; s.drain_arg = drain_arg;
+    s.njobs = (npids + SCAN_BLOCK - 1) / SCAN_BLOCK;
+    if (nthreads > s.njobs) nthreads = s.njobs;
+    s.direct = nthreads <= 1;
+    if (!(s.jobs = (struct job *)calloc(s.njobs ? s.njobs : 1, sizeof(struct job)))) return -1;
+    for (int n = 0; n < s.njobs; n++) {
+        s.jobs[n].s = &s;
+        s.jobs[n].ob = s.direct ? &s.out : &s.jobs[n].own;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    if (!s.direct && (tids = (pthread_t *)malloc(sizeof(pthread_t) * nthreads)))
+        for (; nt < nthreads; nt++)
+            if (pthread_create(&tids[nt], NULL, worker, &s)) break;
+
+    for (int n = 0; n < s.njobs; n++) {
+        if (!nt) {
+            job_run(&s, n);                                                 /* Single threaded: do it ourselves */
+        } else {
+            pthread_mutex_lock(&s.lock);
+            while (!s.jobs[n].done) pthread_cond_wait(&s.cond, &s.lock);
+            pthread_mutex_unlock(&s.lock);
+        }
+        if (s.direct) continue;
+
+        /* Small jobs are gathered to write them out at once */
+        if (s.out.ob_len + s.jobs[n].own.ob_len >= OBUF_FLUSH) {
+            drain(&s.out, drain_arg);
+            drain(&s.jobs[n].own, drain_arg);
+        } else
+            obuf_put(&s.out, s.jobs[n].own.ob_buf, s.jobs[n].own.ob_len);
+        obuf_free(&s.jobs[n].own);
+    }
+    drain(&s.out, drain_arg);
+    obuf_free(&s.out);
+
+    for (int t = 0; t < nt; t++) pthread_join(tids[t], NULL);
+    free(tids);
+    free(s.jobs);
+    pthread_cond_destroy(&s.cond);
+    pthread_mutex_destroy(&s.lock);
+    return 0;
+}
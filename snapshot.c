@@ -0,0 +1,525 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: binary snapshots, -o writer and -i mmap-based reader                                                     */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* Snapshot file layout. All numbers are little-endian, records are not aligned:
+*
+* Header:   "SKST" | u16 version | u16 header length
+* Process:  'P' | u32 pid | u32 uid | u8 len, command | u8 len, user name
+* Socket:   'S' | u8 SF_* flags | u16 kind | u8 state | i32 fd | u64 ino
+*           [u64 pcb]                                       SF_PCB, otherwise pcb is ino
+*           [u16 lport | u16 fport | laddr | faddr]         SF_ADDR4 or SF_ADDR6: 4 or 16 bytes of an address
+*           [u32 u[0] | u32 u[1] | u32 u[2]]                SF_U
+*           [u8 len, path]                                  SF_PATH
+*           [u8 len, cpath]                                 SF_CPATH
+*           [u64 peer]                                      SF_PEER, version 2
+*           [u8 CX_* | u32 sendq | u32 recvq | u32 rtt      SF_EXT, version 2
+*            | u32 retrans | u32 cwnd]
+* End:      'E'
+*
+* Sockets belong to the process record before them. A file without the end record is incomplete. The -w mode keeps
+* its ticks in memory as such records, without the header and the end
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "sockstat.h"
+#include "hash.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define SNAP_MAGIC      "SKST"
+#define SNAP_VERSION    2
+#define SNAP_HDRLEN     8                                                   /* Newer versions may add to the end */
+
+#define SF_PCB          0x01
+#define SF_ADDR4        0x02
+#define SF_ADDR6        0x04
+#define SF_U            0x08
+#define SF_PATH         0x10
+#define SF_CPATH        0x20
+#define SF_PEER         0x40
+#define SF_EXT          0x80
+
+#define REC_MAX         (1 + 1 + 2 + 1 + 4 + 8 + 8 + 4 + 32 + 12 + 2 * (1 + SR_PATHLEN) + 8 + 21)
+#define PROC_MAX        (1 + 4 + 4 + 1 + PR_COMMLEN + 1 + 256)
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const unsigned char *map = NULL;                                     /* -i file */
+static size_t map_size = 0;
+static int map_read = 0;                                                    /* A pipe: read into memory, not mapped */
+static pid_t *map_pids = NULL;                                              /* Processes in the file order */
+static int map_npids = 0;
+static struct hash map_procs;                                               /* PID => process record offset */
+static struct hash map_peers;                                               /* -x: UNIX socket => owner's offset */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static unsigned char *put_le(unsigned char *p, uint64_t v, int n) {
+    while (n--) { *p++ = (unsigned char)v; v >>= 8; }
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static uint64_t get_le(const unsigned char *p, int n) {
+    uint64_t v = 0;
+
+    while (n--) v = v << 8 | p[n];
+    return v;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static unsigned char *put_lstr(unsigned char *p, const char *s, size_t max) {
+    size_t l = strnlen(s, max - 1);
+
+    *p++ = (unsigned char)l;
+    memcpy(p, s, l);
+    return p + l;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const unsigned char *get_lstr(const unsigned char *p, const unsigned char *end, char *s, size_t max) {
+    /* Length prefixed string => s[max], NULL if it does not fit either */
+    if (p >= end || *p >= max || end - p - 1 < *p) return NULL;
+    memcpy(s, p + 1, *p);
+    s[*p] = '\0';
+    return p + 1 + *p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_begin(struct obuf *ob) {
+    unsigned char *p;
+
+    if (obuf_grow(ob, SNAP_HDRLEN) == -1) return -1;
+    p = (unsigned char *)ob->ob_buf + ob->ob_len;
+    memcpy(p, SNAP_MAGIC, 4);
+    p = put_le(p + 4, SNAP_VERSION, 2);
+    p = put_le(p, SNAP_HDRLEN, 2);
+    ob->ob_len = (char *)p - ob->ob_buf;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_end(struct obuf *ob) {
+    return obuf_put(ob, "E", 1);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static unsigned char *put_proc(unsigned char *p, const struct proc_rec *pr) {
+    *p++ = 'P';
+    p = put_le(p, (uint32_t)pr->pr_pid, 4);
+    p = put_le(p, pr->pr_uid, 4);
+    p = put_lstr(p, pr->pr_comm, PR_COMMLEN);
+    return put_lstr(p, uid_name(pr->pr_uid), 256);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static unsigned char *put_sock(unsigned char *p, const struct sock_rec *sr) {
+    unsigned char *fl;
+    int v6;
+
+    *p++ = 'S';
+    *(fl = p++) = 0;
+    p = put_le(p, (uint16_t)sr->sr_kind, 2);
+    *p++ = (unsigned char)sr->sr_state;
+    p = put_le(p, (uint32_t)sr->sr_fd, 4);
+    p = put_le(p, sr->sr_ino, 8);
+    if (sr->sr_pcb != sr->sr_ino) {
+        *fl |= SF_PCB;
+        p = put_le(p, sr->sr_pcb, 8);
+    }
+    if (sr->sr_kind & SK_INET) {
+        v6 = sr->sr_kind & (SK_TCP6 | SK_UDP6);
+        *fl |= v6 ? SF_ADDR6 : SF_ADDR4;
+        p = put_le(p, sr->sr_lport, 2);
+        p = put_le(p, sr->sr_fport, 2);
+        memcpy(p, &sr->sr_laddr, v6 ? 16 : 4);
+        p += v6 ? 16 : 4;
+        memcpy(p, &sr->sr_faddr, v6 ? 16 : 4);
+        p += v6 ? 16 : 4;
+    }
+    if (sr->sr_u[0] || sr->sr_u[1] || sr->sr_u[2]) {
+        *fl |= SF_U;
+        for (int i = 0; i < 3; i++) p = put_le(p, sr->sr_u[i], 4);
+    }
+    if (sr->sr_path[0]) {
+        *fl |= SF_PATH;
+        p = put_lstr(p, sr->sr_path, SR_PATHLEN);
+    }
+    if (sr->sr_cpath[0]) {
+        *fl |= SF_CPATH;
+        p = put_lstr(p, sr->sr_cpath, SR_PATHLEN);
+    }
+    if (sr->sr_peer) {
+        *fl |= SF_PEER;
+        p = put_le(p, sr->sr_peer, 8);
+    }
+    if (sr->sr_ext) {
+        *fl |= SF_EXT;
+        *p++ = (unsigned char)sr->sr_ext;
+        p = put_le(p, sr->sr_sendq, 4);
+        p = put_le(p, sr->sr_recvq, 4);
+        p = put_le(p, sr->sr_rtt, 4);
+        p = put_le(p, sr->sr_retrans, 4);
+        p = put_le(p, sr->sr_cwnd, 4);
+    }
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void snapshot_put(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg) {
+    /* Sink: a socket record, preceded by the process one when a new process begins in this buffer */
+    static __thread const struct obuf *last_ob = NULL;
+    static __thread pid_t last_pid;
+    unsigned char *p;
+
+    if (!sock_match((const struct filter *)arg, sr)) return;
+    if (obuf_grow(ob, REC_MAX + PROC_MAX) == -1) return;
+    p = (unsigned char *)ob->ob_buf + ob->ob_len;
+
+    if (!ob->ob_len || last_ob != ob || last_pid != pr->pr_pid) {           /* Drained only between processes */
+        p = put_proc(p, pr);
+        last_ob = ob;
+        last_pid = pr->pr_pid;
+    }
+    p = put_sock(p, sr);
+    ob->ob_len = (char *)p - ob->ob_buf;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_add(struct obuf *ob, const struct proc_rec *pr, const struct sock_rec *sr) {
+    /* Append a process record if pr is given, then a socket one if sr is. No header: records of a -w tick */
+    unsigned char *p;
+
+    if (obuf_grow(ob, REC_MAX + PROC_MAX) == -1) return -1;
+    p = (unsigned char *)ob->ob_buf + ob->ob_len;
+    if (pr) p = put_proc(p, pr);
+    if (sr) p = put_sock(p, sr);
+    ob->ob_len = (char *)p - ob->ob_buf;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const unsigned char *rec_proc(const unsigned char *p, const unsigned char *end, struct proc_rec *pr,
+    char *uname) {
+    /* Decode a process record at p into pr and uname[256]. Returns the next record or NULL if it is broken */
+    if (end - p < 9) return NULL;
+    memset(pr, 0, sizeof(*pr));
+    pr->pr_pid = (pid_t)get_le(p, 4);
+    pr->pr_uid = (uid_t)get_le(p + 4, 4);
+    if (!(p = get_lstr(p + 8, end, pr->pr_comm, PR_COMMLEN))) return NULL;
+    return get_lstr(p, end, uname, 256);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const unsigned char *rec_sock(const unsigned char *p, const unsigned char *end, struct sock_rec *sr) {
+    /* Decode a socket record at p into sr. Returns the next record or NULL if it is broken */
+    int fl, alen;
+
+    if (end - p < 16) return NULL;
+    memset(sr, 0, sizeof(*sr));
+    fl = p[0];
+    sr->sr_kind = (int)get_le(p + 1, 2);
+    sr->sr_state = p[3];
+    sr->sr_fd = (int)(int32_t)get_le(p + 4, 4);
+    sr->sr_ino = sr->sr_pcb = get_le(p + 8, 8);
+    p += 16;
+
+    if (fl & SF_PCB) {
+        if (end - p < 8) return NULL;
+        sr->sr_pcb = get_le(p, 8);
+        p += 8;
+    }
+    if (fl & (SF_ADDR4 | SF_ADDR6)) {
+        alen = fl & SF_ADDR6 ? 16 : 4;
+        if (end - p < 4 + 2 * alen) return NULL;
+        sr->sr_lport = (uint16_t)get_le(p, 2);
+        sr->sr_fport = (uint16_t)get_le(p + 2, 2);
+        memcpy(&sr->sr_laddr, p + 4, alen);
+        memcpy(&sr->sr_faddr, p + 4 + alen, alen);
+        p += 4 + 2 * alen;
+    }
+    if (fl & SF_U) {
+        if (end - p < 12) return NULL;
+        for (int i = 0; i < 3; i++) sr->sr_u[i] = (uint32_t)get_le(p + i * 4, 4);
+        p += 12;
+    }
+    if (fl & SF_PATH && !(p = get_lstr(p, end, sr->sr_path, SR_PATHLEN))) return NULL;
+    if (fl & SF_CPATH && !(p = get_lstr(p, end, sr->sr_cpath, SR_PATHLEN))) return NULL;
+    if (fl & SF_PEER) {
+        if (end - p < 8) return NULL;
+        sr->sr_peer = get_le(p, 8);
+        p += 8;
+    }
+    if (fl & SF_EXT) {
+        if (end - p < 21) return NULL;
+        sr->sr_ext = p[0];
+        sr->sr_sendq = (uint32_t)get_le(p + 1, 4);
+        sr->sr_recvq = (uint32_t)get_le(p + 5, 4);
+        sr->sr_rtt = (uint32_t)get_le(p + 9, 4);
+        sr->sr_retrans = (uint32_t)get_le(p + 13, 4);
+        sr->sr_cwnd = (uint32_t)get_le(p + 17, 4);
+        p += 21;
+    }
+    return p;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+size_t snapshot_get(const struct obuf *ob, size_t off, struct proc_rec *pr, struct sock_rec *sr) {
+    /* Decode the record at off into pr or sr, as its type says. Returns where the next one starts, 0 if broken */
+    const unsigned char *buf = (const unsigned char *)ob->ob_buf, *p = buf + off, *end = buf + ob->ob_len;
+    char uname[256];
+
+    if (p >= end) return 0;
+    p = *p == 'P' ? rec_proc(p + 1, end, pr, uname) : *p == 'S' ? rec_sock(p + 1, end, sr) : NULL;
+    return p ? (size_t)(p - buf) : 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_index(void) {
+    /* One pass over the file: check every record and remember where processes are */
+    const unsigned char *p, *q, *end = map + map_size;
+    struct proc_rec pr;
+    struct sock_rec sr;
+    char uname[256];
+    uint64_t *v;
+    pid_t *np;
+    int isnew = 0, mpids = 0, inproc = 0;
+
+    if (hash_init(&map_procs, 1024) == -1) return -1;
+    for (p = map + get_le(map + 6, 2); p < end && *p != 'E'; ) {
+        switch (*p++) {
+            case 'P':
+                if (!(q = rec_proc(p, end, &pr, uname))) goto broken;       /* Before the PID is used */
+                if (!(v = hash_put(&map_procs, (uint32_t)pr.pr_pid, &isnew))) return -1;
+                if (isnew) *v = (uint64_t)(p - map);                        /* Keep the first one */
+                p = q;
+                inproc = 1;
+                if (!isnew) break;
+                uid_name_set(pr.pr_uid, uname);
+                if (map_npids == mpids) {
+                    mpids = mpids ? mpids * 2 : 1024;
+                    if (!(np = (pid_t *)realloc(map_pids, sizeof(pid_t) * mpids))) return -1;
+                    map_pids = np;
+                }
+                map_pids[map_npids++] = pr.pr_pid;
+            break;
+
+            case 'S':
+                if (!inproc || !(p = rec_sock(p, end, &sr))) goto broken;
+            break;
+
+            default:
+                goto broken;
+        }
+    }
+    if (p < end) return 0;
+
+broken:
+    errno = EINVAL;
+    return -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int map_file(int fd, size_t size) {
+    if (!size) return 0;                                                    /* mmap() refuses, let the check fail */
+    if ((map = (const unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        map = NULL;
+        return -1;
+    }
+    map_size = size;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int map_stream(int fd) {
+    /* Pipes can not be mapped: -o - | -i /dev/stdin */
+    struct obuf ob = {0};
+    ssize_t n;
+
+    do {
+        if (obuf_grow(&ob, 1024 * 1024) == -1) {
+            obuf_free(&ob);
+            return -1;
+        }
+        if ((n = read(fd, ob.ob_buf + ob.ob_len, ob.ob_size - ob.ob_len)) == -1 && errno != EINTR) {
+            obuf_free(&ob);
+            return -1;
+        }
+        if (n > 0) ob.ob_len += n;
+    } while (n);
+
+    map = (const unsigned char *)ob.ob_buf;
+    map_size = ob.ob_len;
+    map_read = 1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_check(void) {
+    /* EINVAL if the map is not a complete snapshot of a known version */
+    if (map_size < SNAP_HDRLEN + 1 || memcmp(map, SNAP_MAGIC, 4) || get_le(map + 4, 2) > SNAP_VERSION ||
+        get_le(map + 6, 2) < SNAP_HDRLEN || get_le(map + 6, 2) >= map_size) {
+        errno = EINVAL;
+        return -1;
+    }
+    return snapshot_index();
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_open(const char *path) {
+    /* mmap() the -i file, check and index it */
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) return -1;
+    if (fstat(fd, &st) == -1 || (S_ISREG(st.st_mode) ? map_file(fd, (size_t)st.st_size) : map_stream(fd)) == -1) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return snapshot_check();
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_load(struct obuf *ob) {
+    /* A snapshot made in memory, e.g. by -x. The buffer is taken over and freed by fini() */
+    map = (const unsigned char *)ob->ob_buf;
+    map_size = ob->ob_len;
+    map_read = 1;
+    ob->ob_buf = NULL;
+    ob->ob_len = ob->ob_size = 0;
+    return snapshot_check();
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int snapshot_peers(void) {
+    /* -x: UNIX socket identity => the process record of its first owner. Then snapshot_socks() can tell who is on
+    the other end of a socket in O(1). The records were checked by snapshot_index() */
+    const unsigned char *p, *end = map + map_size, *proc = map;
+    struct proc_rec pr;
+    struct sock_rec sr;
+    char uname[256];
+    uint64_t *v;
+    int isnew;
+
+    if (hash_init(&map_peers, 4096) == -1) return -1;
+    for (p = map + get_le(map + 6, 2); p && p < end && *p != 'E'; ) {
+        if (*p == 'P') {
+            proc = p + 1;
+            p = rec_proc(p + 1, end, &pr, uname);
+            continue;
+        }
+        if (!(p = rec_sock(p + 1, end, &sr)) || sr.sr_kind != SK_UNIX) continue;
+        if ((v = hash_put(&map_peers, sr.sr_ino, &isnew)) && isnew) *v = (uint64_t)(proc - map);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_init(const struct filter *f) {
+    if (map) return 0;
+    errno = EBADF;                                                          /* No snapshot_open() */
+    return -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_pids(pid_t **pids, int *npids) {
+    if (!(*pids = (pid_t *)malloc(sizeof(pid_t) * (map_npids ? map_npids : 1)))) return -1;
+    memcpy(*pids, map_pids, sizeof(pid_t) * map_npids);
+    *npids = map_npids;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_proc(pid_t pid, struct proc_rec *pr) {
+    char uname[256];
+    uint64_t *v;
+
+    if (!(v = hash_get(&map_procs, (uint32_t)pid))) return -1;
+    return rec_proc(map + *v, map + map_size, pr, uname) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snapshot_socks(const struct proc_rec *pr, const struct filter *f, emit_fn emit, void *arg) {
+    /* The socket records after the process one. They were checked by snapshot_index() */
+    const unsigned char *p, *end = map + map_size;
+    struct proc_rec fpr;
+    struct sock_rec sr;
+    char uname[256];
+    uint64_t *v;
+
+    if (!(v = hash_get(&map_procs, (uint32_t)pr->pr_pid))) return -1;
+    for (p = rec_proc(map + *v, end, &fpr, uname); p && p < end && *p == 'S'; ) {
+        if (!(p = rec_sock(p + 1, end, &sr))) return -1;
+        if (!(sr.sr_kind & f->f_want)) continue;
+        if (sr.sr_peer && map_peers.size && (v = hash_get(&map_peers, sr.sr_peer)) &&
+            rec_proc(map + *v, end, &fpr, uname)) {
+            sr.sr_ppid = fpr.pr_pid;
+            memcpy(sr.sr_pcomm, fpr.pr_comm, sizeof(sr.sr_pcomm));
+        }
+        emit(pr, &sr, arg);
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void snapshot_fini(void) {
+    if (map_read)
+        free((void *)map);
+    else if (map)
+        munmap((void *)map, map_size);
+    map = NULL;
+    map_read = 0;
+    map_size = 0;
+    free(map_pids);
+    map_pids = NULL;
+    map_npids = 0;
+    hash_free(&map_procs);
+    hash_free(&map_peers);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+const struct backend snapshot_backend = {
+    "snapshot",
+    snapshot_init,
+    snapshot_pids,
+    snapshot_proc,
+    snapshot_socks,
+    snapshot_fini,
+    NULL,                                                                   /* No -w over a file */
+    NULL,
+    NULL
+};
@@ -1,5 +1,5 @@
 /* ------------------------------------------------------------------------------------------------------------------ */
-/* FreeBSD-like sockstat for macOS using libproc                                                                      */
+/* FreeBSD-like sockstat for macOS and Linux                                                                          */
 /* ------------------------------------------------------------------------------------------------------------------ */
 
 /*
@@ -28,40 +28,70 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <limits.h>
+
+#include <fcntl.h>
 
 #include <sys/types.h>
-#include <sys/sysctl.h>
 #include <pwd.h>
-#include <uuid/uuid.h>
-
-#include <arpa/inet.h>
 
-#include <libproc.h>
+#include "sockstat.h"
 
 /* ------------------------------------------------------------------------------------------------------------------ */
 void usage(int ecode);
+static void *list_add(void *list, int *n, const void *item, size_t size);
+static void parse_pids(char *arg, struct filter *f);
+static void parse_users(char *arg, struct filter *f);
+static void parse_comms(char *arg, struct filter *f);
+static void parse_ports(char *arg, struct filter *f);
 
 /* ------------------------------------------------------------------------------------------------------------------ */
 #define PROG_NAME       "sockstat"
-#define PROG_VERSION    "1.1.0"
+#define PROG_VERSION    "1.2.0"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void print_sock(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg) {
+    if (sock_match((const struct filter *)arg, sr)) sock_format(pr, sr, ob);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const struct backend *scan_peers(const struct backend *be, const struct filter *f, int nthreads) {
+    /* -x: a peer may belong to a process the filters drop, so first all sockets of the system go into an in-memory
+    snapshot, about 40 bytes per socket. The filters are applied when it is shown */
+    struct filter all = {0};
+    struct obuf ob = {0};
+    pid_t *pids = NULL;
+    int npids = 0;
+
+    all.f_want = f->f_want;
+    all.f_peers = 1;
+    all.f_cols = f->f_cols;
+    STATS_ENTER(ST_TABLES);
+    if (be->init(&all) == -1) return NULL;
+    STATS_LEAVE();
+    if (scan_pids(be, &all, &pids, &npids) == -1 || snapshot_begin(&ob) == -1) return NULL;
+    scan_run(be, &all, pids, npids, nthreads, snapshot_put, &all, drain_mem, &ob);
+    if (stats_on) stats_prescan();
+    free(pids);
+    be->fini();
+    if (snapshot_end(&ob) == -1 || snapshot_load(&ob) == -1) return NULL;
+    return &snapshot_backend;
+}
 
-#define MAXPROC         16384;
 /* ------------------------------------------------------------------------------------------------------------------ */
 int main(int argc, char* argv[]) {
-    int mproc = MAXPROC;                                                    /* Max number of concurrent processes */
-    size_t mproc_len = sizeof(mproc);                                       /* Set it enormously big to tune later*/
-    int *pids = NULL;                                                       /* PIDs array buffer */
+    const struct backend *be = NULL;                                        /* OS specific socket collection */
+    struct filter filter = {0};
+    pid_t *pids = NULL;                                                     /* PIDs array buffer */
     int npids = 0;                                                          /* Number of PIDs */
-    static struct proc_fdinfo *fds = NULL;                                  /* FDs array */
-    int mfds = 0, nfds = 0;                                                 /* Memory and number of FDS */
-    struct proc_bsdinfo pinfo;
-    struct socket_fdinfo si;
-    struct passwd *pwd;
-    char buf[INET6_ADDRSTRLEN] = {0};                                       /* Local/Remote IPv4/6 addresses bufs */
-    char outstr[160] = {0};
-    int ready = 0;                                                          /* Socket info collected - ready to print */
-    int listen = 1;                                                         /* Socket is listening for flg_l output */
+    int njobs = 1;                                                          /* Scanning threads */
+    int outfd = STDOUT_FILENO;
+    double interval = 0;                                                    /* -w watch mode tick, seconds */
+    const char *snap_in = NULL;                                             /* -i snapshot to read */
+    const char *snap_out = NULL;                                            /* -o snapshot to write */
+    struct obuf ob = {0};
+    char *sum_keys = NULL;                                                  /* -s aggregation keys */
+    int topk = 0;                                                           /* -K */
+    char *cols = NULL;                                                      /* -O extended columns */
 
     int flg = 0;                                                            /* CLI flags, see below */
     int flg_i4 = 0;                                                         /* IPv4 */
@@ -75,261 +105,300 @@ int main(int argc, char* argv[]) {
     int flg_r = 0;                                                          /* ROUTE sockets */
     int flg_u = 0;                                                          /* UNIX aka LOCAL sockets */
     int flg_a = 0;                                                          /* pseudo-flag ALL socket flags are on */
+    int flg_N = 0;                                                          /* Linux: netlink sock_diag */
+    int flg_t = 0;                                                          /* Watch TCP state changes too */
+    int flg_x = 0;                                                          /* Owners of UNIX peers */
 
 
-    while ((flg = getopt(argc, argv, "46TUklnrquhv")) != -1)
+    while ((flg = getopt(argc, argv, "46TUc:e:i:j:kK:lnNo:O:p:P:rqs:Stuw:xhv")) != -1)
         switch(flg) {
             case '4': flg_i4 = 1; break;
             case '6': flg_i6 = 1; break;
             case 'T': flg_T = 1; break;
             case 'U': flg_U = 1; break;
+            case 'c': parse_comms(optarg, &filter); break;
+            case 'e': parse_users(optarg, &filter); break;
+            case 'i': snap_in = optarg; break;
+            case 'j':
+                if ((njobs = atoi(optarg)) < 1 || njobs > 1024) (void)usage(1);
+            break;
             case 'k': flg_k = 1; break;
+            case 'K':
+                if ((topk = atoi(optarg)) < 1) (void)usage(1);
+            break;
             case 'l': flg_l = 1; break;
             case 'n': flg_n = 1; break;
+            case 'N': flg_N = 1; break;
+            case 'o': snap_out = optarg; break;
+            case 'O': cols = optarg; break;
+            case 'p': parse_pids(optarg, &filter); break;
+            case 'P': parse_ports(optarg, &filter); break;
             case 'q': flg_q = 1; break;
             case 'r': flg_r = 1; break;
+            case 's': sum_keys = optarg; break;
+            case 'S': stats_on = 1; break;
+            case 't': flg_t = 1; break;
             case 'u': flg_u = 1; break;
+            case 'w':
+                if ((interval = strtod(optarg, NULL)) <= 0) (void)usage(1);
+            break;
+            case 'x': flg_x = 1; break;
             case 'h': (void)usage(0); break;
             case 'v': printf("%s %s\n", PROG_NAME, PROG_VERSION); exit(0); break;
             default: (void)usage(1);
         }
 
+    if (interval && (snap_in || snap_out || stats_on)) (void)usage(1);
+    if (stats_on) stats_get();                                              /* Starts the clock */
+    if (sum_keys && (interval || snap_out)) (void)usage(1);
+    if (topk && !sum_keys) (void)usage(1);
+    if (flg_x && (interval || sum_keys)) (void)usage(1);
+    if (cols && (sum_keys || (filter.f_cols = cols_init(cols)) == -1)) (void)usage(1);
+    if (sum_keys && summary_init(sum_keys, topk) == -1) (void)usage(1);
     if (!flg_i4 && !flg_i6 && !flg_T && !flg_U && !flg_k && !flg_n && !flg_r && !flg_u) flg_a = 1;
 
-    if (sysctlbyname("kern.maxproc", &mproc, &mproc_len, NULL, 0) == -1) {
-        perror("Unable to get the maximum allowed number of processes");
-        printf("Assuming it to be lower than: %d\n", mproc);
+    /* Flags => socket kinds. NB! -4 and -6 only switch off "all", the protocols come from -T and -U */
+    if (flg_a || flg_T) filter.f_want |= SK_TCP;
+    if (flg_a || flg_U) filter.f_want |= SK_UDP;
+    if (flg_a || flg_u) filter.f_want |= SK_UNIX;
+    if (flg_a || flg_r) filter.f_want |= SK_ROUTE;
+    if (flg_a || flg_n) filter.f_want |= SK_NDRV;
+    if (flg_a || flg_k) filter.f_want |= SK_KEVT | SK_KCTL | SK_SUNKN;
+    if (flg_a) filter.f_want |= SK_UNK;
+    if (filter.f_nports) filter.f_want &= SK_INET;                          /* Nothing else has ports */
+    filter.f_listen = flg_l;
+    filter.f_peers = flg_x && filter.f_want & SK_UNIX;
+
+#if defined(__APPLE__)
+    be = &libproc_backend;
+    (void)flg_N;                                                            /* No choice on macOS */
+#elif defined(__linux__)
+    be = flg_N ? &netlink_backend : &procfs_backend;
+#endif
+    if (snap_in) {
+        be = &snapshot_backend;
+        if (snapshot_open(snap_in) == -1) {
+            perror("Unable to read snapshot");
+            exit(1);
+        }
+    }
+    if (snap_out) {
+        outfd = strcmp(snap_out, "-") ? open(snap_out, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+        if (outfd == -1) {
+            perror("Unable to create snapshot");
+            exit(1);
+        }
+        flg_q = 1;                                                          /* No text at all */
+        snapshot_begin(&ob);
     }
 
-    pids = (int *)malloc(sizeof(int) * mproc);
-    /* PIDs */
-    /* NB! proc_listpids() returns bytes (!), not count of pids (!) */
-    npids = proc_listpids(PROC_ALL_PIDS, 0, pids, sizeof(int) * mproc);
+    if (!flg_q && !sum_keys) {
+        printf("%s%-23s\t%-5s\t%-31s\t%-3s\t%-5s\t%-19s\t%s", interval ? "EV\t" : "",
+            "USER", "PID", "COMMAND", "FD", "PROTO", "LOCAL ADDRESS", "REMOTE ADDRESS");
+        cols_header();
+        printf("\n");
+    }
 
-    fds = (struct proc_fdinfo *)malloc(sizeof(struct proc_fdinfo) * OPEN_MAX);
+    if (!filter.f_want && !snap_out) return 0;
 
-    if (!flg_q)
-        printf("%-23s\t%-5s\t%-31s\t%-3s\t%-5s\t%-19s\t%s\n",
-            "USER", "PID", "COMMAND", "FD", "PROTO", "LOCAL ADDRESS", "REMOTE ADDRESS");
+    if (interval) {
+        fflush(stdout);
+        if (watch_run(be, &filter, interval, flg_t, njobs) == -1) {
+            perror("Unable to watch sockets");
+            exit(1);
+        }
+        return 0;
+    }
 
-    for (int i = 0; i < npids/sizeof(int); i++) {
-        /* PID => FDs */
-        if ((mfds = proc_pidinfo(pids[i], PROC_PIDLISTFDS, 0, fds, sizeof(struct proc_fdinfo) * OPEN_MAX))) {
-            /* a PIDs => PID */
-            proc_pidinfo(pids[i], PROC_PIDTBSDINFO, 0, &pinfo, sizeof(pinfo));
-
-            nfds = (int)(mfds / sizeof(struct proc_fdinfo));
-            for (int k = 0; k < nfds; k++) {
-                if (proc_pidfdinfo(pids[i], fds[k].proc_fd, PROC_PIDFDSOCKETINFO, &si, sizeof(si)) >= sizeof(si)) {
-                    pwd = getpwuid(pinfo.pbi_uid);
-
-                    sprintf(outstr, "%-23s\t%-5d\t%-31s\t%-3d",
-                        pwd->pw_name, pinfo.pbi_pid, pinfo.pbi_name[0] ? pinfo.pbi_name : pinfo.pbi_comm,
-                        fds[k].proc_fd);
-
-                    ready = 0;
-                    listen = 0;
-
-                    switch (si.psi.soi_family) {
-                        case AF_INET:
-                            if (flg_i4 || flg_a || flg_T || flg_U) {
-                                if (si.psi.soi_kind == SOCKINFO_TCP && (flg_a || flg_T)) { /* IPv4 TCP */
-                                    /* Local address and port */
-                                    if (si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_lport) {
-                                        sprintf(outstr + strlen(outstr), "\ttcp4\t%s:%d",
-                                            si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_laddr.ina_46.i46a_addr4.s_addr ==
-                                                INADDR_ANY ? "*" : inet_ntop(AF_INET,
-                                                    &si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_laddr.ina_46.i46a_addr4,
-                                                    buf, INET_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_lport));
-                                        if (si.psi.soi_proto.pri_tcp.tcpsi_state == TSI_S_LISTEN) listen = 1;
-                                        ready = 1;
-                                    }
-                                    /* Remote address and port */
-                                    if (si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_fport) {
-                                        sprintf(outstr + strlen(outstr), "\t%s:%d",
-                                            inet_ntop(AF_INET,
-                                                &si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_faddr.ina_46.i46a_addr4,
-                                                buf, INET_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_fport));
-                                        ready = 1;
-                                    } else {
-                                        /* No port - no address */
-                                        sprintf(outstr + strlen(outstr), "\t*:*");
-                                        ready = 1;
-                                    }
-                                } else if (flg_a || flg_U) { /* IPv4 UDP */
-                                    /* Local address and port */
-                                    if (si.psi.soi_proto.pri_in.insi_lport) {
-                                        sprintf(outstr + strlen(outstr), "\tudp4\t%s:%d",
-                                            si.psi.soi_proto.pri_in.insi_laddr.ina_46.i46a_addr4.s_addr ==
-                                                INADDR_ANY ? "*" : inet_ntop(AF_INET,
-                                                    &si.psi.soi_proto.pri_in.insi_laddr.ina_46.i46a_addr4,
-                                                    buf, INET_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_in.insi_lport));
-                                    } else {
-                                        sprintf(outstr+strlen(outstr), "\tudp4\t%s:*",
-                                            si.psi.soi_proto.pri_in.insi_laddr.ina_46.i46a_addr4.s_addr ==
-                                                INADDR_ANY ? "*" : inet_ntop(AF_INET,
-                                                    &si.psi.soi_proto.pri_in.insi_laddr.ina_46.i46a_addr4,
-                                                    buf, INET_ADDRSTRLEN));
-                                    }
-                                    /* Remote address and port */
-                                    /* UDP is stateless protocol, marking it LISTEN */
-                                    listen = 1;
-                                    sprintf(outstr + strlen(outstr), "\t*:*");
-                                    ready = 1;
-                                }
-                            }
-                        break;
-
-                        case AF_INET6:
-                            if (flg_i6 || flg_a || flg_T || flg_U) {
-                                if (si.psi.soi_kind == SOCKINFO_TCP && (flg_a || flg_T)) { /* IPv6 TCP */
-                                    /* Local address and port */
-                                    if (si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_lport) {
-                                        sprintf(outstr + strlen(outstr), "\ttcp6\t%s:%d",
-                                            IN6_IS_ADDR_UNSPECIFIED(&si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_laddr.ina_6) ?
-                                                "*" : inet_ntop(AF_INET6,
-                                                    &si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_laddr.ina_6,
-                                                    buf, INET6_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_lport));
-                                            if (si.psi.soi_proto.pri_tcp.tcpsi_state == TSI_S_LISTEN) listen = 1;
-                                        ready = 1;
-                                    }
-                                    /* Remote address and port */
-                                    if (si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_fport) {
-                                        sprintf(outstr + strlen(outstr), "\t%s:%d",
-                                            inet_ntop(AF_INET6,
-                                                &si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_faddr.ina_6,
-                                                buf, INET6_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_tcp.tcpsi_ini.insi_fport));
-                                            ready = 1;
-                                    } else {
-                                        /* No port - no address */
-                                        sprintf(outstr + strlen(outstr), "\t*:*");
-                                        ready = 1;
-                                    }
-                                } else if (flg_a || flg_U) { /* IPv6 UDP */
-                                    listen = 1;
-                                    /* Local address and port */
-                                    if (si.psi.soi_proto.pri_in.insi_lport) {
-                                        sprintf(outstr + strlen(outstr), "\tudp6\t%s:%d",
-                                            IN6_IS_ADDR_UNSPECIFIED(&si.psi.soi_proto.pri_in.insi_laddr.ina_6) ?
-                                                "*" : inet_ntop(AF_INET6,
-                                                    &si.psi.soi_proto.pri_in.insi_laddr.ina_6,
-                                                    buf, INET6_ADDRSTRLEN),
-                                            ntohs(si.psi.soi_proto.pri_in.insi_lport));
-                                        ready = 1;
-                                    } else {
-                                        sprintf(outstr + strlen(outstr), "\tudp6\t%s:*",
-                                            IN6_IS_ADDR_UNSPECIFIED(&si.psi.soi_proto.pri_in.insi_laddr.ina_6) ?
-                                                "*" : inet_ntop(AF_INET6,
-                                                    &si.psi.soi_proto.pri_in.insi_laddr.ina_6,
-                                                    buf, INET6_ADDRSTRLEN));
-                                        ready = 1;
-                                    }
-                                    /* Remote address and port */
-                                    /* UDP is stateless protocol, marking it LISTEN */
-                                    listen = 1;
-                                    sprintf(outstr + strlen(outstr), "\t*:*");
-                                    ready = 1;
-                                }
-                            }
-                        break;
-
-                        case AF_UNIX: /* aka LOCAL socket */
-                            if (flg_u || flg_a) {
-                                sprintf(outstr + strlen(outstr), "\tunix");
-                                /* Bound address */
-                                if (si.psi.soi_proto.pri_un.unsi_addr.ua_sun.sun_path[0])
-                                    sprintf(outstr + strlen(outstr), "\t%s",
-                                        si.psi.soi_proto.pri_un.unsi_addr.ua_sun.sun_path);
-                                else
-                                    sprintf(outstr + strlen(outstr), "\t0x%llx",
-                                        si.psi.soi_proto.pri_un.unsi_conn_pcb);
-                                /* Address of socket connected to */
-                                if (si.psi.soi_proto.pri_un.unsi_caddr.ua_sun.sun_path[0])
-                                    sprintf(outstr + strlen(outstr), "\t%s",
-                                        si.psi.soi_proto.pri_un.unsi_caddr.ua_sun.sun_path);
-                                else {
-                                    sprintf(outstr + strlen(outstr), "\t->??");
-                                    listen = 1;
-                                }
-                                ready = 1;
-                            }
-                        break;
-
-                        case AF_ROUTE: /* Not much info, do we need more? */
-                            if (flg_r || flg_a) {
-                                sprintf(outstr + strlen(outstr), "\troute\t0x%llx", si.psi.soi_pcb);
-                                ready = 1;
-                            }
-                        break;
-
-                        case AF_NDRV:
-                            if (flg_n || flg_a) {
-                                if (si.psi.soi_kind == SOCKINFO_NDRV) { /* is this check useless? */
-                                    sprintf(outstr + strlen(outstr), "\tndrv\tunit: %d name: %s",
-                                        si.psi.soi_proto.pri_ndrv.ndrvsi_if_unit,
-                                        si.psi.soi_proto.pri_ndrv.ndrvsi_if_name);
-                                    ready = 1;
-                                }
-                            }
-                        break;
-
-                        case AF_SYSTEM:
-                            if (flg_k || flg_a) {
-                                switch (si.psi.soi_kind) {
-                                    case SOCKINFO_KERN_EVENT:
-                                        sprintf(outstr + strlen(outstr), "\tkevt\t0x%llx evt: 0x%x:0x%x:0x%x",
-                                            si.psi.soi_pcb,
-                                            si.psi.soi_proto.pri_kern_event.kesi_vendor_code_filter,
-                                            si.psi.soi_proto.pri_kern_event.kesi_class_filter,
-                                            si.psi.soi_proto.pri_kern_event.kesi_subclass_filter);
-                                        ready = 1;
-                                    break;
-
-                                    case SOCKINFO_KERN_CTL:
-                                        sprintf(outstr + strlen(outstr), "\tkctl\t0x%llx ctl: %s id: %d unit: %d",
-                                            si.psi.soi_pcb,
-                                            si.psi.soi_proto.pri_kern_ctl.kcsi_name,
-                                            si.psi.soi_proto.pri_kern_ctl.kcsi_id,
-                                            si.psi.soi_proto.pri_kern_ctl.kcsi_unit);
-                                        ready = 1;
-                                    break;
-
-                                    default: /* May this ever happen? */
-                                        sprintf(outstr + strlen(outstr), "\tsunkn");
-                                        ready = 1;
-                                    break;
-                                }
-                            }
-                        break;
-
-
-                        default:
-                            if (flg_a) {
-                                sprintf(outstr + strlen(outstr), "\tunk");
-                                ready = 1;
-                            }
-                        break;
-                    }
-                    if (ready && ((flg_l && listen) || !flg_l)) {
-                        puts(outstr);
-                    }
-                }
-            }
+    /* With -o the peers are only saved, for -i -x later */
+    if (filter.f_peers && !snap_in && !snap_out && !(be = scan_peers(be, &filter, njobs))) {
+        perror("Unable to collect sockets");
+        exit(1);
+    }
+
+    STATS_ENTER(ST_TABLES);
+    if (filter.f_peers && !snap_out && snapshot_peers() == -1) {
+        perror("Unable to index UNIX peers");
+        exit(1);
+    }
+    if (be->init(&filter) == -1) {
+        perror("Unable to collect sockets");
+        exit(1);
+    }
+    STATS_LEAVE();
+    if (scan_pids(be, &filter, &pids, &npids) == -1) {
+        perror("Unable to collect sockets");
+        exit(1);
+    }
+
+    fflush(stdout);                                                         /* The rows bypass stdio */
+    if (snap_out) {
+        drain_fd(&ob, &outfd);
+        scan_run(be, &filter, pids, npids, njobs, snapshot_put, &filter, drain_fd, &outfd);
+        snapshot_end(&ob);
+        if (drain_fd(&ob, &outfd) == -1 || close(outfd) == -1) {
+            perror("Unable to write snapshot");
+            exit(1);
         }
+        obuf_free(&ob);
+    } else if (sum_keys) {
+        scan_run(be, &filter, pids, npids, njobs, summary_put, &filter, drain_fd, &outfd);
+        STATS_ENTER(ST_FORMAT);
+        summary_print(!flg_q);
+        STATS_LEAVE();
+    } else
+        scan_run(be, &filter, pids, npids, njobs, print_sock, &filter, drain_fd, &outfd);
+
+    free(pids);
+    be->fini();
+    if (stats_on) stats_print();
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int sock_match(const struct filter *f, const struct sock_rec *sr) {
+    /* Last line filters, for what backends could not filter out themselves. Runs before any formatting */
+    if (!(sr->sr_kind & f->f_want)) return 0;
+    if (f->f_listen && !sock_listen(sr)) return 0;
+    if (f->f_nports && !(sr->sr_kind & SK_INET && ports_match(f, sr->sr_lport, sr->sr_fport))) return 0;
+    STATS_ADD(st_matched, 1);
+    return 1;
+}
 
+/* ------------------------------------------------------------------------------------------------------------------ */
+int proc_match(const struct filter *f, const struct proc_rec *pr) {
+    /* Process level filters: -p, -e, -c. Runs before FDs of the process are enumerated */
+    int i;
+
+    if (f->f_npids) {
+        for (i = 0; i < f->f_npids && f->f_pids[i] != pr->pr_pid; i++) ;
+        if (i == f->f_npids) return 0;
+    }
+    if (f->f_nuids) {
+        for (i = 0; i < f->f_nuids && f->f_uids[i] != pr->pr_uid; i++) ;
+        if (i == f->f_nuids) return 0;
+    }
+    if (f->f_ncomms) {
+        for (i = 0; i < f->f_ncomms && !strstr(pr->pr_comm, f->f_comms[i]); i++) ;
+        if (i == f->f_ncomms) return 0;
     }
+    return 1;
+}
 
+/* ------------------------------------------------------------------------------------------------------------------ */
+int ports_match(const struct filter *f, uint16_t lport, uint16_t fport) {
+    /* Either local or remote port is in one of -P ranges */
+    for (int i = 0; i < f->f_nports; i++)
+        if ((lport >= f->f_ports[i].lo && lport <= f->f_ports[i].hi) ||
+            (fport >= f->f_ports[i].lo && fport <= f->f_ports[i].hi))
+            return 1;
     return 0;
 }
 
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void *list_add(void *list, int *n, const void *item, size_t size) {
+    char *l;
+
+    if (!(l = (char *)realloc(list, size * (*n + 1)))) {
+        perror("Unable to allocate memory for filters");
+        exit(1);
+    }
+    memcpy(l + size * (*n)++, item, size);
+    return l;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void parse_pids(char *arg, struct filter *f) {
+    /* -p pid[,pid...] */
+    char *t, *e, *last = NULL;
+    pid_t pid;
+    int i;
+
+    for (t = strtok_r(arg, ",", &last); t; t = strtok_r(NULL, ",", &last)) {
+        pid = (pid_t)strtol(t, &e, 10);
+        if (*e || pid < 0) {
+            fprintf(stderr, "Bad PID: %s\n", t);
+            exit(1);
+        }
+        for (i = 0; i < f->f_npids && f->f_pids[i] != pid; i++) ;
+        if (i == f->f_npids) f->f_pids = (pid_t *)list_add(f->f_pids, &f->f_npids, &pid, sizeof(pid));
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void parse_users(char *arg, struct filter *f) {
+    /* -e user[,user...], names or UIDs */
+    char *t, *e, *last = NULL;
+    struct passwd *pwd;
+    uid_t uid;
+
+    for (t = strtok_r(arg, ",", &last); t; t = strtok_r(NULL, ",", &last)) {
+        if ((pwd = getpwnam(t))) {
+            uid = pwd->pw_uid;
+        } else {
+            uid = (uid_t)strtoul(t, &e, 10);
+            if (*e || !*t) {
+                fprintf(stderr, "Unknown user: %s\n", t);
+                exit(1);
+            }
+        }
+        f->f_uids = (uid_t *)list_add(f->f_uids, &f->f_nuids, &uid, sizeof(uid));
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void parse_comms(char *arg, struct filter *f) {
+    /* -c command[,command...] */
+    char *t, *last = NULL;
+
+    for (t = strtok_r(arg, ",", &last); t; t = strtok_r(NULL, ",", &last))
+        f->f_comms = (char **)list_add(f->f_comms, &f->f_ncomms, &t, sizeof(t));
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void parse_ports(char *arg, struct filter *f) {
+    /* -P port[,port-port...] */
+    char *t, *e, *last = NULL;
+    unsigned long lo, hi;
+    struct prange r;
+
+    for (t = strtok_r(arg, ",", &last); t; t = strtok_r(NULL, ",", &last)) {
+        lo = hi = strtoul(t, &e, 10);
+        if (*e == '-') hi = strtoul(e + 1, &e, 10);
+        if (*e || e == t || lo > hi || hi > 65535) {
+            fprintf(stderr, "Bad port or range: %s\n", t);
+            exit(1);
+        }
+        r.lo = (uint16_t)lo;
+        r.hi = (uint16_t)hi;
+        f->f_ports = (struct prange *)list_add(f->f_ports, &f->f_nports, &r, sizeof(r));
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int sock_listen(const struct sock_rec *sr) {
+    /* Is the socket LISTENing for the -l output */
+    switch (sr->sr_kind) {
+        case SK_TCP4:
+        case SK_TCP6:
+            return sr->sr_lport && sr->sr_state == TS_LISTEN;
+
+        case SK_UDP4:
+        case SK_UDP6:
+            return 1;                                                       /* UDP is stateless protocol */
+
+        case SK_UNIX:
+            return !sr->sr_cpath[0];                                        /* Not connected to a named socket */
+
+        default:
+            return 0;
+    }
+}
+
 /* ------------------------------------------------------------------------------------------------------------------ */
 void usage(int ecode) {
-    printf("Usage: sockstat [-46TUklnrquhv]\n\n\
+    printf("Usage: sockstat [-46TUklnNrqStuxhv] [-c command] [-e user] [-i file] [-j threads] [-K top] [-o file]\n\
+                [-O columns] [-p pid] [-P port] [-s keys] [-w interval]\n\n\
     -4\tShow AF_INET (IPv4) sockets\n\
     -6\tShow AF_INET6 (IPv6) sockets\n\
     -T\tShow TCP protocol\n\
@@ -340,7 +409,22 @@ void usage(int ecode) {
     -u\tShow AF_LOCAL (UNIX) sockets\n\
     \n\
     -l\tShow only LISTENing sockets\n\
+    -c\tShow only commands with names containing any of comma separated strings\n\
+    -e\tShow only sockets of comma separated users, names or UIDs\n\
+    -p\tShow only sockets of comma separated PIDs\n\
+    -P\tShow only sockets with local or remote port in comma separated ports or ranges: 80,443,8000-8100\n\
     -q\tQuiet mode - suppress header\n\
+    -N\tLinux: collect sockets over netlink sock_diag instead of /proc/net\n\
+    -j\tScan processes with this many threads, 1 by default\n\
+    -w\tWatch: every interval seconds show sockets opened (+), closed (-) or changed (~)\n\
+    -t\tWith -w, also show TCP state changes (~)\n\
+    -O\tAdd comma separated TCP columns: sendq, recvq, rtt (ms), retrans, cwnd, state; - if not known\n\
+    -x\tShow owners of UNIX peers as ->pid/command; all processes are scanned to find them. With -o save the peers\n\
+    -o\tWrite the sockets to a binary snapshot file instead of the table, - for stdout\n\
+    -i\tRead the sockets from a snapshot file made by -o instead of the system\n\
+    -s\tShow socket counts by comma separated keys: user, proc, command, proto, state, lport, peer (/24 or /64)\n\
+    -K\tWith -s, show only the top counts; memory is bounded, ~ marks upper bounds of approximate counts\n\
+    -S\tPrint time spent in each phase of the scan, syscalls and memory to stderr at the end\n\
     \n\
     -h\tThis help message\n\
     -v\tShow program version\n\n");
@@ -0,0 +1,243 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* FreeBSD-like sockstat for macOS and Linux                                                                          */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#ifndef SOCKSTAT_H
+#define SOCKSTAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* Socket kinds. Each one is a bit in the filter "want" mask, so backends can skip what nobody asked for */
+#define SK_TCP4         0x0001
+#define SK_TCP6         0x0002
+#define SK_UDP4         0x0004
+#define SK_UDP6         0x0008
+#define SK_UNIX         0x0010
+#define SK_ROUTE        0x0020
+#define SK_NDRV         0x0040
+#define SK_KEVT         0x0080                                              /* AF_SYSTEM kernel event */
+#define SK_KCTL         0x0100                                              /* AF_SYSTEM kernel control */
+#define SK_SUNKN        0x0200                                              /* AF_SYSTEM of unknown kind */
+#define SK_UNK          0x0400                                              /* Any other family */
+
+#define SK_TCP          (SK_TCP4 | SK_TCP6)
+#define SK_UDP          (SK_UDP4 | SK_UDP6)
+#define SK_INET         (SK_TCP | SK_UDP)
+
+/* TCP states, normalized. Backends translate their native values into these */
+#define TS_UNKNOWN      0
+#define TS_CLOSED       1
+#define TS_LISTEN       2
+#define TS_SYN_SENT     3
+#define TS_SYN_RECEIVED 4
+#define TS_ESTABLISHED  5
+#define TS_CLOSE_WAIT   6
+#define TS_FIN_WAIT_1   7
+#define TS_CLOSING      8
+#define TS_LAST_ACK     9
+#define TS_FIN_WAIT_2   10
+#define TS_TIME_WAIT    11
+
+/* -O extended columns. Backends fetch what is behind them only when selected */
+#define CX_SENDQ        0x01                                                /* Bytes in the send queue */
+#define CX_RECVQ        0x02                                                /* Bytes not read by the process yet */
+#define CX_RTT          0x04                                                /* Smoothed round trip time */
+#define CX_RETRANS      0x08                                                /* Retransmitted segments, total */
+#define CX_CWND         0x10                                                /* Congestion window, segments */
+#define CX_STATE        0x20                                                /* TCP state name */
+#define CX_QUEUES       (CX_SENDQ | CX_RECVQ)
+#define CX_INFO         (CX_RTT | CX_RETRANS | CX_CWND)                     /* Linux: struct tcp_info */
+
+#define PR_COMMLEN      33                                                  /* 2 * MAXCOMLEN + 1 on macOS */
+#define SR_PATHLEN      108                                                 /* The biggest sun_path around */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct proc_rec {                                                           /* A process owning sockets */
+    pid_t pr_pid;
+    uid_t pr_uid;
+    char pr_comm[PR_COMMLEN];
+};
+
+struct sock_rec {                                                           /* A decoded socket */
+    int sr_fd;                                                              /* Descriptor in the owning process */
+    int sr_kind;                                                            /* SK_* */
+    int sr_state;                                                           /* TS_* for TCP, TS_UNKNOWN otherwise */
+    uint16_t sr_lport;                                                      /* Local and remote ports, host order */
+    uint16_t sr_fport;
+    struct in6_addr sr_laddr;                                               /* IPv4 lives in the first 4 bytes */
+    struct in6_addr sr_faddr;
+    uint64_t sr_ino;                                                        /* Socket identity: inode or PCB */
+    uint64_t sr_pcb;                                                        /* Kernel handle to show to the user */
+    uint32_t sr_u[3];                                                       /* Kind specific numbers, see below */
+    char sr_path[SR_PATHLEN];                                               /* UNIX bound path, NDRV/KCTL name */
+    char sr_cpath[SR_PATHLEN];                                              /* UNIX connected-to path */
+    uint64_t sr_peer;                                                       /* UNIX peer's sr_ino, 0 - unknown */
+    pid_t sr_ppid;                                                          /* -x: the peer's owner, 0 - unknown */
+    char sr_pcomm[PR_COMMLEN];
+    int sr_ext;                                                             /* -O: CX_* known below, "-" if not */
+    uint32_t sr_sendq;                                                      /* Bytes */
+    uint32_t sr_recvq;
+    uint32_t sr_rtt;                                                        /* Microseconds */
+    uint32_t sr_retrans;
+    uint32_t sr_cwnd;
+};
+/* sr_u: NDRV - unit; KEVT - vendor, class, subclass filters; KCTL - id, unit */
+
+struct prange {                                                             /* Port range, both inclusive */
+    uint16_t lo;
+    uint16_t hi;
+};
+
+struct filter {                                                             /* What to collect */
+    int f_want;                                                             /* SK_* mask */
+    int f_listen;                                                           /* Only LISTENing sockets */
+    pid_t *f_pids;                                                          /* -p: only these PIDs */
+    int f_npids;
+    uid_t *f_uids;                                                          /* -e: only these users */
+    int f_nuids;
+    char **f_comms;                                                         /* -c: command name substrings */
+    int f_ncomms;
+    struct prange *f_ports;                                                 /* -P: local or remote port ranges */
+    int f_nports;
+    int f_peers;                                                            /* -x: UNIX peers are needed */
+    int f_cols;                                                             /* -O: CX_* to fetch */
+};
+
+typedef void (*emit_fn)(const struct proc_rec *pr, const struct sock_rec *sr, void *arg);
+
+struct backend {                                                            /* OS specific collection */
+    const char *name;
+    int (*init)(const struct filter *f);                                    /* Prepare global tables, if any */
+    int (*pids)(pid_t **pids, int *npids);                                  /* Allocate and fill PIDs array */
+    int (*proc)(pid_t pid, struct proc_rec *pr);                            /* PID => process info */
+    int (*socks)(const struct proc_rec *pr, const struct filter *f, emit_fn emit, void *arg);
+    void (*fini)(void);
+    /* Optional, for the -w mode to skip unchanged processes. NULL if the platform can not tell */
+    int (*fdsig)(pid_t pid, uint64_t *sig);                                 /* Cheap signature of the FD table */
+    int (*rejoin)(struct sock_rec *sr);                                     /* Refresh from the tables, -1 if gone */
+    void (*idents)(void (*fn)(uint64_t ino, void *arg), void *arg);         /* All sockets in the tables */
+};
+/* NB! proc() and socks() are called from several threads at once with -j */
+
+struct obuf {                                                               /* Append-only output buffer */
+    char *ob_buf;
+    size_t ob_len;                                                          /* The cursor */
+    size_t ob_size;
+};
+
+#define OBUF_FLUSH      (256 * 1024)                                        /* Write out when that much is ready */
+
+typedef void (*sink_fn)(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg);
+typedef int (*drain_fn)(struct obuf *ob, void *arg);                        /* Consume ob and empty it */
+
+/* -S statistics. Time goes to the innermost phase entered, so nested phases are not counted twice */
+#define ST_PIDS         0                                                   /* PID enumeration */
+#define ST_TABLES       1                                                   /* Global socket tables, Linux */
+#define ST_PROC         2                                                   /* Process name and owner */
+#define ST_FDS          3                                                   /* FD listing */
+#define ST_SOCKS        4                                                   /* Socket queries per FD */
+#define ST_NAMES        5                                                   /* UID => user name */
+#define ST_FORMAT       6                                                   /* Sinks: rows, records or counts */
+#define ST_OUTPUT       7
+#define ST_NPHASES      8
+#define ST_DEPTH        8
+
+struct stats {                                                              /* Per thread, summed up at the end */
+    uint64_t st_ns[ST_NPHASES];
+    uint64_t st_procs;                                                      /* Processes scanned */
+    uint64_t st_fds;                                                        /* FDs inspected */
+    uint64_t st_socks;                                                      /* Sockets found */
+    uint64_t st_matched;                                                    /* Sockets passed the filters */
+    uint64_t st_syscalls;                                                   /* Issued by sockstat itself */
+    uint64_t st_bytes;                                                      /* Allocated by buffers and tables */
+    uint64_t st_pre_procs;                                                  /* -x pre-scan of the whole system */
+    uint64_t st_pre_fds;
+    uint64_t st_pre_socks;
+    int st_phase[ST_DEPTH];                                                 /* Entered phases */
+    int st_depth;
+    uint64_t st_since;                                                      /* The last enter or leave, ns */
+    struct stats *st_next;
+};
+
+extern int stats_on;
+
+/* The hooks cost a branch while -S is off */
+#define STATS_ENTER(ph) do { if (stats_on) stats_enter(ph); } while (0)
+#define STATS_LEAVE()   do { if (stats_on) stats_leave(); } while (0)
+#define STATS_ADD(c, n) do { if (stats_on) stats_get()->c += (n); } while (0)
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int obuf_grow(struct obuf *ob, size_t need);
+int obuf_put(struct obuf *ob, const char *s, size_t l);
+void obuf_free(struct obuf *ob);
+int obuf_flush(struct obuf *ob, int fd);
+int drain_fd(struct obuf *ob, void *arg);
+int drain_mem(struct obuf *ob, void *arg);
+int scan_run(const struct backend *be, const struct filter *f, const pid_t *pids, int npids, int nthreads,
+    sink_fn sink, const void *sink_arg, drain_fn drain, void *drain_arg);
+int sock_format(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob);
+int cols_init(char *cols);
+void cols_header(void);
+const char *tcp_state_name(int state);
+const char *kind_name(int kind);
+const char *uid_name(uid_t uid);
+void uid_name_set(uid_t uid, const char *name);
+int sock_listen(const struct sock_rec *sr);
+int sock_match(const struct filter *f, const struct sock_rec *sr);
+int proc_match(const struct filter *f, const struct proc_rec *pr);
+int ports_match(const struct filter *f, uint16_t lport, uint16_t fport);
+int scan_pids(const struct backend *be, const struct filter *f, pid_t **pids, int *npids);
+int watch_run(const struct backend *be, const struct filter *f, double interval, int states, int nthreads);
+int snapshot_begin(struct obuf *ob);
+int snapshot_end(struct obuf *ob);
+void snapshot_put(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg);
+int snapshot_add(struct obuf *ob, const struct proc_rec *pr, const struct sock_rec *sr);
+size_t snapshot_get(const struct obuf *ob, size_t off, struct proc_rec *pr, struct sock_rec *sr);
+int snapshot_open(const char *path);
+int snapshot_load(struct obuf *ob);
+int snapshot_peers(void);
+struct stats *stats_get(void);
+void stats_enter(int phase);
+void stats_leave(void);
+void stats_prescan(void);
+void stats_print(void);
+int summary_init(char *keys, int topk);
+void summary_put(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg);
+int summary_print(int header);
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+extern const struct backend snapshot_backend;                               /* -i file, any platform */
+#if defined(__APPLE__)
+extern const struct backend libproc_backend;
+#endif
+#if defined(__linux__)
+extern const struct backend procfs_backend;
+extern const struct backend netlink_backend;
+#endif
+
+#endif /* SOCKSTAT_H */
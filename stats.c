@@ -0,0 +1,157 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: -S self instrumentation, phase timings and counters                                                      */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <pthread.h>
+
+#include "sockstat.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int stats_on = 0;
+
+static struct stats *all = NULL;                                            /* Of all threads */
+static pthread_mutex_t all_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t started = 0;
+
+static const char *phases[ST_NPHASES] = {
+    "PID enumeration", "socket tables", "process info", "FD listing", "socket queries", "user names",
+    "formatting", "output"
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct stats *stats_get(void) {
+    /* The calling thread's block. Blocks outlive threads, so workers need no merge on exit */
+    static __thread struct stats *mine = NULL;
+    static struct stats lost;                                               /* Out of memory: count somewhere */
+
+    if (mine) return mine;
+    if (!(mine = (struct stats *)calloc(1, sizeof(struct stats)))) return &lost;
+    pthread_mutex_lock(&all_lock);
+    if (!started) started = now_ns();
+    mine->st_next = all;
+    all = mine;
+    pthread_mutex_unlock(&all_lock);
+    return mine;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void stats_enter(int phase) {
+    struct stats *st = stats_get();
+    uint64_t t = now_ns();
+
+    if (st->st_depth) st->st_ns[st->st_phase[st->st_depth - 1]] += t - st->st_since;
+    if (st->st_depth < ST_DEPTH) st->st_phase[st->st_depth] = phase;
+    st->st_depth++;
+    st->st_since = t;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void stats_leave(void) {
+    struct stats *st = stats_get();
+    uint64_t t = now_ns();
+
+    if (!st->st_depth) return;
+    st->st_depth--;
+    st->st_ns[st->st_phase[st->st_depth < ST_DEPTH ? st->st_depth : ST_DEPTH - 1]] += t - st->st_since;
+    st->st_since = t;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void stats_prescan(void) {
+    /* Counters so far belong to the -x pre-scan: keep them apart, so the rest counts what is shown. Its threads are
+    joined, and time, syscalls and bytes stay where they are as they are spent all the same */
+    pthread_mutex_lock(&all_lock);
+    for (struct stats *st = all; st; st = st->st_next) {
+        st->st_pre_procs += st->st_procs;
+        st->st_pre_fds += st->st_fds;
+        st->st_pre_socks += st->st_socks;
+        st->st_procs = st->st_fds = st->st_socks = st->st_matched = 0;
+    }
+    pthread_mutex_unlock(&all_lock);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void stats_print(void) {
+    /* Sum up all threads and report to stderr. With -j phases may take more than the wall time together */
+    struct stats sum = {0};
+    struct rusage ru;
+    uint64_t wall = now_ns() - started, busy = 0;
+    long rss = 0;
+
+    pthread_mutex_lock(&all_lock);
+    for (struct stats *st = all; st; st = st->st_next) {
+        for (int i = 0; i < ST_NPHASES; i++) sum.st_ns[i] += st->st_ns[i];
+        sum.st_procs += st->st_procs;
+        sum.st_fds += st->st_fds;
+        sum.st_socks += st->st_socks;
+        sum.st_matched += st->st_matched;
+        sum.st_syscalls += st->st_syscalls;
+        sum.st_bytes += st->st_bytes;
+        sum.st_pre_procs += st->st_pre_procs;
+        sum.st_pre_fds += st->st_pre_fds;
+        sum.st_pre_socks += st->st_pre_socks;
+    }
+    pthread_mutex_unlock(&all_lock);
+    for (int i = 0; i < ST_NPHASES; i++) busy += sum.st_ns[i];
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0) rss = ru.ru_maxrss;
+#if defined(__APPLE__)
+    rss /= 1024;                                                            /* Bytes on macOS */
+#endif
+
+    fprintf(stderr, "\n%-20s%12.3f ms\n", "wall time", wall / 1e6);
+    for (int i = 0; i < ST_NPHASES; i++)
+        fprintf(stderr, "%-20s%12.3f ms %5.1f%%\n", phases[i], sum.st_ns[i] / 1e6,
+            busy ? sum.st_ns[i] * 100.0 / busy : 0.0);
+    fprintf(stderr, "%-20s%12llu\n", "processes", (unsigned long long)sum.st_procs);
+    fprintf(stderr, "%-20s%12llu\n", "FDs", (unsigned long long)sum.st_fds);
+    fprintf(stderr, "%-20s%12llu\n", "sockets", (unsigned long long)sum.st_socks);
+    fprintf(stderr, "%-20s%12llu\n", "sockets matched", (unsigned long long)sum.st_matched);
+    if (sum.st_pre_procs) {
+        fprintf(stderr, "%-20s%12llu\n", "-x processes", (unsigned long long)sum.st_pre_procs);
+        fprintf(stderr, "%-20s%12llu\n", "-x FDs", (unsigned long long)sum.st_pre_fds);
+        fprintf(stderr, "%-20s%12llu\n", "-x sockets", (unsigned long long)sum.st_pre_socks);
+    }
+    fprintf(stderr, "%-20s%12llu\n", "syscalls", (unsigned long long)sum.st_syscalls);
+    fprintf(stderr, "%-20s%12llu\n", "bytes allocated", (unsigned long long)sum.st_bytes);
+    fprintf(stderr, "%-20s%12ld KB\n", "peak RSS", rss);
+}
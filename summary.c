@@ -0,0 +1,337 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: -s summary mode, socket counts aggregated while scanning                                                 */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sockstat.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define SM_USER         1
+#define SM_PROC         2                                                   /* PID and command */
+#define SM_COMMAND      3                                                   /* Command of any PID */
+#define SM_PROTO        4
+#define SM_STATE        5
+#define SM_LPORT        6
+#define SM_PEER         7                                                   /* Remote /24 or /64 network */
+
+#define SM_MAXKEYS      8
+#define SM_SLACK        16                                                  /* -K n keeps n * SM_SLACK counters */
+#define SM_MINCAP       16384                                               /* but no less than that, ~2 MB */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct skey {                                                               /* Zeroed but for the -s keys */
+    struct in6_addr peer;
+    uid_t uid;
+    pid_t pid;
+    int kind;
+    int state;
+    int lport;                                                              /* -1 if the socket has no ports */
+    int pfam;                                                               /* peer: 4, 6, 0 - none, -1 - no ports */
+    char comm[PR_COMMLEN];
+};
+
+struct sent {                                                               /* A counter */
+    struct skey k;
+    uint64_t hash;
+    uint64_t count;
+    uint64_t err;                                                           /* count may be over by that much */
+    size_t pos;                                                             /* In the heap */
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static const struct {
+    const char *name;
+    int key;
+    const char *title;
+} sm_names[] = {
+    {"user", SM_USER, "USER"}, {"proc", SM_PROC, "PID\tCOMMAND"}, {"command", SM_COMMAND, "COMMAND"},
+    {"proto", SM_PROTO, "PROTO"}, {"state", SM_STATE, "STATE"}, {"lport", SM_LPORT, "LPORT"},
+    {"peer", SM_PEER, "PEER"}
+};
+
+static int sm_keys[SM_MAXKEYS];                                             /* In the -s order */
+static int sm_nkeys = 0;
+static int sm_want = 0;                                                     /* 1 << SM_* */
+static size_t sm_topk = 0;                                                  /* -K, 0 - show all */
+static size_t sm_cap = 0;                                                   /* Counters limit, 0 - none */
+
+static struct sent *ents = NULL;
+static size_t nents = 0, ments = 0;
+static uint32_t *tab = NULL;                                                /* Open addressing, ents index + 1 */
+static size_t tsize = 0;
+static size_t *heap = NULL;                                                 /* With -K: ents by count, min first */
+static pthread_mutex_t sm_lock = PTHREAD_MUTEX_INITIALIZER;                 /* Sockets come from all -j threads */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int summary_init(char *keys, int topk) {
+    /* -s key[,key...] and -K topk. Returns -1 on an unknown key */
+    char *t, *last = NULL;
+    size_t i;
+
+    for (t = strtok_r(keys, ",", &last); t; t = strtok_r(NULL, ",", &last)) {
+        for (i = 0; i < sizeof(sm_names) / sizeof(sm_names[0]) && strcmp(t, sm_names[i].name); i++) ;
+        if (i == sizeof(sm_names) / sizeof(sm_names[0]) || sm_want & 1 << sm_names[i].key) return -1;
+        sm_keys[sm_nkeys++] = sm_names[i].key;
+        sm_want |= 1 << sm_names[i].key;
+    }
+    if (!sm_nkeys) return -1;
+
+    sm_topk = topk > 0 ? (size_t)topk : 0;
+    sm_cap = sm_topk ? (sm_topk * SM_SLACK > SM_MINCAP ? sm_topk * SM_SLACK : SM_MINCAP) : 0;
+    if (sm_cap) {
+        if (!(ents = (struct sent *)malloc(sizeof(struct sent) * sm_cap))) return -1;
+        if (!(heap = (size_t *)malloc(sizeof(size_t) * sm_cap))) return -1;
+        ments = sm_cap;
+    }
+    for (tsize = 64; tsize < (sm_cap ? sm_cap : 512) * 2; tsize <<= 1) ;
+    if (!(tab = (uint32_t *)calloc(tsize, sizeof(uint32_t)))) return -1;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static uint64_t skey_hash(const struct skey *k) {
+    /* FNV-1a */
+    const unsigned char *p = (const unsigned char *)k;
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < sizeof(*k); i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static size_t tab_find(const struct skey *k, uint64_t h) {
+    /* Slot of the key or the empty slot where it belongs */
+    size_t i;
+
+    for (i = h & (tsize - 1); tab[i]; i = (i + 1) & (tsize - 1))
+        if (ents[tab[i] - 1].hash == h && !memcmp(&ents[tab[i] - 1].k, k, sizeof(*k))) break;
+    return i;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void tab_del(size_t i) {
+    /* Linear probing delete: move back the following entries that would not be found past the hole */
+    size_t j = i, k;
+
+    for (tab[i] = 0;;) {
+        j = (j + 1) & (tsize - 1);
+        if (!tab[j]) return;
+        k = ents[tab[j] - 1].hash & (tsize - 1);
+        if (i <= j ? i < k && k <= j : i < k || k <= j) continue;           /* Still reachable */
+        tab[i] = tab[j];
+        tab[j] = 0;
+        i = j;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int tab_grow(void) {
+    uint32_t *n;
+    size_t i, nsize = tsize * 2;
+
+    if (!(n = (uint32_t *)calloc(nsize, sizeof(uint32_t)))) return -1;
+    STATS_ADD(st_bytes, nsize * sizeof(uint32_t));
+    for (size_t e = 0; e < nents; e++) {
+        for (i = ents[e].hash & (nsize - 1); n[i]; i = (i + 1) & (nsize - 1)) ;
+        n[i] = (uint32_t)(e + 1);
+    }
+    free(tab);
+    tab = n;
+    tsize = nsize;
+    return 0;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void heap_down(size_t i) {
+    /* The counter at i has grown: sink it below smaller ones */
+    size_t c, t;
+
+    for (; (c = 2 * i + 1) < nents; i = c) {
+        if (c + 1 < nents && ents[heap[c + 1]].count < ents[heap[c]].count) c++;
+        if (ents[heap[i]].count <= ents[heap[c]].count) break;
+        t = heap[i]; heap[i] = heap[c]; heap[c] = t;
+        ents[heap[i]].pos = i;
+        ents[heap[c]].pos = c;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void heap_up(size_t i) {
+    size_t p, t;
+
+    for (; i && ents[heap[p = (i - 1) / 2]].count > ents[heap[i]].count; i = p) {
+        t = heap[i]; heap[i] = heap[p]; heap[p] = t;
+        ents[heap[i]].pos = i;
+        ents[heap[p]].pos = p;
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void count(const struct skey *k) {
+    /* Exact counts, or Space-Saving with -K: when all counters are taken, a new key replaces the smallest one and
+    inherits its count as the error. Any key seen more than total / counters times is kept */
+    uint64_t h = skey_hash(k);
+    size_t i = tab_find(k, h), e;
+    struct sent *n;
+
+    if (tab[i]) {
+        e = tab[i] - 1;
+        ents[e].count++;
+        if (sm_cap) heap_down(ents[e].pos);
+        return;
+    }
+
+    if (sm_cap && nents == sm_cap) {
+        e = heap[0];
+        tab_del(tab_find(&ents[e].k, ents[e].hash));
+        ents[e].k = *k;
+        ents[e].hash = h;
+        ents[e].err = ents[e].count++;
+        tab[tab_find(k, h)] = (uint32_t)(e + 1);
+        heap_down(0);
+        return;
+    }
+
+    if ((nents + 1) * 2 > tsize) {
+        if (tab_grow() == -1) return;
+        i = tab_find(k, h);
+    }
+    if (nents == ments) {
+        if (!(n = (struct sent *)realloc(ents, sizeof(struct sent) * (ments ? ments * 2 : 1024)))) return;
+        STATS_ADD(st_bytes, sizeof(struct sent) * (ments ? ments : 1024));
+        ents = n;
+        ments = ments ? ments * 2 : 1024;
+    }
+    e = nents++;
+    ents[e].k = *k;
+    ents[e].hash = h;
+    ents[e].count = 1;
+    ents[e].err = 0;
+    tab[i] = (uint32_t)(e + 1);
+    if (sm_cap) {
+        heap[e] = e;
+        ents[e].pos = e;
+        heap_up(e);
+    }
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+void summary_put(const struct proc_rec *pr, const struct sock_rec *sr, struct obuf *ob, const void *arg) {
+    /* Sink: the socket => its key => +1. Nothing is formatted or kept per socket */
+    struct skey k;
+    int inet = sr->sr_kind & SK_INET;
+    const uint8_t *fa = (const uint8_t *)&sr->sr_faddr;
+
+    if (!sock_match((const struct filter *)arg, sr)) return;
+
+    memset(&k, 0, sizeof(k));                                               /* Padding too, for hash and memcmp */
+    if (sm_want & 1 << SM_USER) k.uid = pr->pr_uid;
+    if (sm_want & 1 << SM_PROC) k.pid = pr->pr_pid;
+    if (sm_want & (1 << SM_PROC | 1 << SM_COMMAND)) strncpy(k.comm, pr->pr_comm, PR_COMMLEN);
+    if (sm_want & 1 << SM_PROTO) k.kind = sr->sr_kind;
+    if (sm_want & 1 << SM_STATE) k.state = sr->sr_kind & SK_TCP ? sr->sr_state : -1;
+    if (sm_want & 1 << SM_LPORT) k.lport = inet ? sr->sr_lport : -1;
+    if (sm_want & 1 << SM_PEER) {
+        if (!inet)
+            k.pfam = -1;
+        else if (!sr->sr_fport)
+            k.pfam = 0;                                                     /* Not connected */
+        else if (sr->sr_kind & (SK_TCP4 | SK_UDP4)) {
+            k.pfam = 4;
+            memcpy(&k.peer, fa, 3);                                         /* /24 */
+        } else if (IN6_IS_ADDR_V4MAPPED(&sr->sr_faddr)) {
+            k.pfam = 4;
+            memcpy(&k.peer, fa + 12, 3);
+        } else {
+            k.pfam = 6;
+            memcpy(&k.peer, fa, 8);                                         /* /64 */
+        }
+    }
+
+    pthread_mutex_lock(&sm_lock);
+    count(&k);
+    pthread_mutex_unlock(&sm_lock);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int sent_cmp(const void *a, const void *b) {
+    /* The biggest counts first, then keep the order stable for the same input */
+    const struct sent *x = (const struct sent *)a, *y = (const struct sent *)b;
+
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return memcmp(&x->k, &y->k, sizeof(x->k));
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int summary_print(int header) {
+    char addr[INET6_ADDRSTRLEN];
+    struct sent *e;
+    size_t n;
+
+    if (header) {
+        printf("COUNT");
+        for (int i = 0; i < sm_nkeys; i++)
+            for (size_t j = 0; j < sizeof(sm_names) / sizeof(sm_names[0]); j++)
+                if (sm_names[j].key == sm_keys[i]) printf("\t%s", sm_names[j].title);
+        printf("\n");
+    }
+
+    qsort(ents, nents, sizeof(struct sent), sent_cmp);
+    n = sm_topk && sm_topk < nents ? sm_topk : nents;
+    for (e = ents; e < ents + n; e++) {
+        printf("%s%llu", e->err ? "~" : "", (unsigned long long)e->count);  /* ~ - an upper bound */
+        for (int i = 0; i < sm_nkeys; i++)
+            switch (sm_keys[i]) {
+                case SM_USER: printf("\t%s", uid_name(e->k.uid)); break;
+                case SM_PROC: printf("\t%d\t%s", (int)e->k.pid, e->k.comm); break;
+                case SM_COMMAND: printf("\t%s", e->k.comm); break;
+                case SM_PROTO: printf("\t%s", kind_name(e->k.kind)); break;
+                case SM_STATE: printf("\t%s", e->k.state == -1 ? "-" : tcp_state_name(e->k.state)); break;
+                case SM_LPORT:
+                    if (e->k.lport == -1) printf("\t-"); else if (!e->k.lport) printf("\t*");
+                    else printf("\t%d", e->k.lport);
+                break;
+                case SM_PEER:
+                    if (e->k.pfam == -1) printf("\t-"); else if (!e->k.pfam) printf("\t*");
+                    else printf("\t%s/%d", inet_ntop(e->k.pfam == 4 ? AF_INET : AF_INET6, &e->k.peer, addr,
+                        sizeof(addr)), e->k.pfam == 4 ? 24 : 64);
+                break;
+            }
+        printf("\n");
+    }
+
+    free(ents); free(heap); free(tab);
+    ents = NULL; heap = NULL; tab = NULL;
+    nents = ments = tsize = 0;
+    return fflush(stdout);
+}
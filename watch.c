@@ -0,0 +1,275 @@
+/* ------------------------------------------------------------------------------------------------------------------ */
+/* sockstat: -w watch mode, incremental snapshot diffs                                                                */
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/*
+* Copyright (c) 2023-2024, Mikhail Zakharov <zmey20000@yahoo.com>
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the
+* following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following
+*    disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and
+*    the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+* SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+* SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+* WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+* OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sockstat.h"
+#include "hash.h"
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+#define FDKEY(pid, fd)  ((uint64_t)(uint32_t)(pid) << 32 | (uint32_t)(fd))
+#define WATCH_FULL      30                                                  /* Enumerate all processes every N ticks */
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+struct snap {                                                               /* Sockets seen on a tick */
+    struct obuf recs;                                                       /* In the snapshot encoding, see -o */
+    struct hash byfd;                                                       /* (PID, FD) => socket record offset */
+    struct hash bypid;                                                      /* PID => process record offset */
+    struct hash sigs;                                                       /* PID => FD table signature */
+    struct hash idents;                                                     /* Sockets in the backend tables */
+};
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void add_ident(uint64_t ino, void *arg) {
+    hash_put((struct hash *)arg, ino, NULL);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void snap_clear(struct snap *sn) {
+    sn->recs.ob_len = 0;
+    hash_clear(&sn->byfd);
+    hash_clear(&sn->bypid);
+    hash_clear(&sn->sigs);
+    hash_clear(&sn->idents);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int snap_init(struct snap *sn) {
+    memset(sn, 0, sizeof(*sn));
+    return hash_init(&sn->byfd, 4096) | hash_init(&sn->bypid, 1024) | hash_init(&sn->sigs, 1024) |
+        hash_init(&sn->idents, 4096);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void snap_index(struct snap *sn) {
+    struct proc_rec pr;
+    struct sock_rec sr;
+    uint64_t *v;
+    size_t next;
+
+    for (size_t off = 0; (next = snapshot_get(&sn->recs, off, &pr, &sr)); off = next)
+        if (sn->recs.ob_buf[off] == 'P') {
+            if ((v = hash_put(&sn->bypid, (uint32_t)pr.pr_pid, NULL))) *v = off;
+        } else if ((v = hash_put(&sn->byfd, FDKEY(pr.pr_pid, sr.sr_fd), NULL)))
+            *v = off;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void snap_free(struct snap *sn) {
+    obuf_free(&sn->recs);
+    hash_free(&sn->byfd);
+    hash_free(&sn->bypid);
+    hash_free(&sn->sigs);
+    hash_free(&sn->idents);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void put_event(struct obuf *ob, char ev, const struct proc_rec *pr, const struct sock_rec *sr,
+    const struct sock_rec *was) {
+    /* "+" opened, "-" closed, "~" changed: with was the TCP state "OLD->NEW" is added to the row */
+    const char *s1, *s2;
+
+    if (obuf_grow(ob, 2) == -1) return;
+    ob->ob_buf[ob->ob_len++] = ev;
+    ob->ob_buf[ob->ob_len++] = '\t';
+    if (!sock_format(pr, sr, ob) || !was) return;
+
+    s1 = tcp_state_name(was->sr_state);
+    s2 = tcp_state_name(sr->sr_state);
+    ob->ob_len--;                                                           /* Drop '\n' */
+    obuf_put(ob, "\t", 1);
+    obuf_put(ob, s1, strlen(s1));
+    obuf_put(ob, "->", 2);
+    obuf_put(ob, s2, strlen(s2));
+    obuf_put(ob, "\n", 1);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int sock_moved(const struct sock_rec *was, const struct sock_rec *sr) {
+    /* The same socket got another kind or address, e.g. it was caught before bind() and listed as unknown */
+    return was->sr_kind != sr->sr_kind || was->sr_lport != sr->sr_lport || was->sr_fport != sr->sr_fport ||
+        memcmp(&was->sr_laddr, &sr->sr_laddr, sizeof(sr->sr_laddr)) ||
+        memcmp(&was->sr_faddr, &sr->sr_faddr, sizeof(sr->sr_faddr)) || strcmp(was->sr_path, sr->sr_path) ||
+        strcmp(was->sr_cpath, sr->sr_cpath);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static void snap_diff(const struct snap *prev, const struct snap *cur, int states, struct obuf *ob, int fd) {
+    /* Rows are paired on (PID, FD, socket) and decoded back from the records only to compare and print them */
+    uint8_t *seen = (uint8_t *)calloc(prev->recs.ob_len / 8 + 1, 1);        /* A bit per prev->recs byte */
+    struct proc_rec pr, ppr;
+    struct sock_rec sr, was;
+    size_t next;
+    uint64_t *v;
+    int state;
+
+    for (size_t off = 0; (next = snapshot_get(&cur->recs, off, &pr, &sr)); off = next) {
+        if (cur->recs.ob_buf[off] == 'P') continue;
+        if ((v = hash_get(&prev->byfd, FDKEY(pr.pr_pid, sr.sr_fd))) && snapshot_get(&prev->recs, *v, &ppr, &was) &&
+            was.sr_ino == sr.sr_ino) {
+            if (seen) seen[*v / 8] |= 1 << *v % 8;
+            state = states && sr.sr_kind & SK_TCP && was.sr_kind == sr.sr_kind && was.sr_state != sr.sr_state;
+            if (state || sock_moved(&was, &sr)) put_event(ob, '~', &pr, &sr, state ? &was : NULL);
+        } else
+            put_event(ob, '+', &pr, &sr, NULL);                             /* A new one or the FD was reused */
+        if (ob->ob_len >= OBUF_FLUSH) obuf_flush(ob, fd);
+    }
+
+    for (size_t off = 0; (next = snapshot_get(&prev->recs, off, &ppr, &was)); off = next) {
+        if (prev->recs.ob_buf[off] == 'P' || (seen && seen[off / 8] & 1 << off % 8)) continue;
+        put_event(ob, '-', &ppr, &was, NULL);
+        if (ob->ob_len >= OBUF_FLUSH) obuf_flush(ob, fd);
+    }
+
+    obuf_flush(ob, fd);
+    free(seen);
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+static int tick(const struct backend *be, const struct filter *f, int nthreads, struct snap *prev, struct snap *cur,
+    unsigned tickno) {
+    /* Take a new snapshot. Processes with the same FD table signature are not enumerated again, unless there are new
+    sockets in the system that were not found in the processes that did change, or some of their sockets are gone.
+    The signature misses an FD replaced by dup2() with a socket the process already had, so every WATCH_FULL ticks
+    all processes are enumerated. -1 if the snapshot is not complete */
+    pid_t *pids = NULL, *dirty = NULL, *clean = NULL;
+    int npids = 0, ndirty = 0, nclean = 0, nredo = 0, gone, r = -1;
+    size_t nnew = 0, found = 0, mark, off, next;
+    struct hash newfound;
+    struct proc_rec pr;
+    struct sock_rec sr;
+    uint64_t sig, *v;
+
+    snap_clear(cur);
+    if (be->init(f) == -1 || scan_pids(be, f, &pids, &npids) == -1) goto done;
+    if (!(dirty = (pid_t *)malloc(sizeof(pid_t) * (npids + 1))) ||
+        !(clean = (pid_t *)malloc(sizeof(pid_t) * (npids + 1))))
+        goto done;
+
+    if (be->idents) {
+        be->idents(add_ident, &cur->idents);
+        for (size_t i = 0; i < cur->idents.size; i++)
+            if (cur->idents.used[i] && !hash_get(&prev->idents, cur->idents.tab[i].key)) nnew++;
+    }
+
+    for (int i = 0; i < npids; i++) {
+        if (be->fdsig && be->fdsig(pids[i], &sig) == 0) {
+            if ((v = hash_put(&cur->sigs, (uint32_t)pids[i], NULL))) *v = sig;
+            if (tickno % WATCH_FULL && (v = hash_get(&prev->sigs, (uint32_t)pids[i])) && *v == sig) {
+                clean[nclean++] = pids[i];
+                continue;
+            }
+        }
+        dirty[ndirty++] = pids[i];
+    }
+
+    if (scan_run(be, f, dirty, ndirty, nthreads, snapshot_put, f, drain_mem, &cur->recs) == -1) goto done;
+
+    if (nclean) {
+        /* Did the changed processes take all new sockets? */
+        if (nnew && hash_init(&newfound, nnew) == 0) {
+            for (off = 0; (next = snapshot_get(&cur->recs, off, &pr, &sr)); off = next)
+                if (cur->recs.ob_buf[off] == 'S' && !hash_get(&prev->idents, sr.sr_ino) &&
+                    hash_get(&cur->idents, sr.sr_ino))
+                    hash_put(&newfound, sr.sr_ino, NULL);
+            found = newfound.count;
+            hash_free(&newfound);
+        }
+
+        if (found < nnew) {
+            if (scan_run(be, f, clean, nclean, nthreads, snapshot_put, f, drain_mem, &cur->recs) == -1) goto done;
+        } else {
+            for (int i = 0; i < nclean; i++) {
+                if (!(v = hash_get(&prev->bypid, (uint32_t)clean[i]))) continue;
+                mark = cur->recs.ob_len;
+                gone = 0;
+                off = snapshot_get(&prev->recs, *v, &pr, &sr);              /* The process, its sockets follow */
+                while (off && off < prev->recs.ob_len && prev->recs.ob_buf[off] == 'S' &&
+                    (next = snapshot_get(&prev->recs, off, &pr, &sr))) {
+                    if ((gone = be->rejoin(&sr) == -1)) break;              /* The FD now holds something else */
+                    if (sock_match(f, &sr)) snapshot_add(&cur->recs, cur->recs.ob_len == mark ? &pr : NULL, &sr);
+                    off = next;
+                }
+                if (gone) {
+                    cur->recs.ob_len = mark;
+                    dirty[nredo++] = clean[i];
+                }
+            }
+            if (scan_run(be, f, dirty, nredo, nthreads, snapshot_put, f, drain_mem, &cur->recs) == -1) goto done;
+        }
+    }
+
+    snap_index(cur);
+    r = 0;
+
+done:
+    be->fini();
+    free(pids);
+    free(dirty);
+    free(clean);
+    return r;
+}
+
+/* ------------------------------------------------------------------------------------------------------------------ */
+int watch_run(const struct backend *be, const struct filter *f, double interval, int states, int nthreads) {
+    /* Print the sockets that were opened or closed since the previous tick. Never returns but on errors */
+    struct snap snaps[2], *prev = &snaps[0], *cur = &snaps[1], *t;
+    struct timespec t0, t1, ts;
+    struct obuf ob = {0};
+    double left;
+
+    if (snap_init(prev) || snap_init(cur)) return -1;
+
+    for (unsigned tickno = 0;; tickno++) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (tick(be, f, nthreads, prev, cur, tickno) == -1) {
+            /* An empty tick would show all sockets closed, then all opened again */
+            perror("Unable to take a snapshot, keeping the previous one");
+        } else {
+            snap_diff(prev, cur, states, &ob, STDOUT_FILENO);
+            t = prev; prev = cur; cur = t;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        left = interval - (t1.tv_sec - t0.tv_sec) - (t1.tv_nsec - t0.tv_nsec) / 1e9;
+        if (left > 0) {
+            ts.tv_sec = (time_t)left;
+            ts.tv_nsec = (long)((left - ts.tv_sec) * 1e9);
+            while (nanosleep(&ts, &ts) == -1) ;
+        }
+    }
+
+    snap_free(prev);
+    snap_free(cur);
+    obuf_free(&ob);
+    return 0;
+}